@@ -5,7 +5,6 @@
 #include <stdlib.h>
 #include "crc32.c"
 #include <iostream>
-using namespace std;
 
 
 // #define ES_MAGIC 0xaa55f155
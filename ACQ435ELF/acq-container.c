@@ -0,0 +1,343 @@
+/* ------------------------------------------------------------------------- */
+/* acq-container.c - chunked, indexed container for validated output        */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "acq-container.h"
+#include "acq-kernels.h"
+
+struct ACQCF_Writer {
+	FILE* fp;
+	struct ACQCF_Header hdr;
+	unsigned* chunk;		/* chunk_records * record_words */
+	struct ACQCF_Chunk ch;
+	struct ACQCF_IndexEntry* index;
+	unsigned nchunks;
+	unsigned maxchunks;
+	unsigned long long offset;	/* bytes written, fp may be a pipe */
+};
+
+struct ACQCF_Reader {
+	FILE* fp;
+	struct ACQCF_Header hdr;
+	unsigned* chunk;
+	unsigned chunk_cap;		/* records: chunk_records, or fewer
+					 * when the whole file holds fewer */
+	struct ACQCF_Chunk ch;
+	unsigned cursor;		/* next record in chunk */
+	struct ACQCF_IndexEntry* index;	/* 0 when fp is not seekable */
+	struct ACQCF_Trailer tr;
+};
+
+static int cfwrite(struct ACQCF_Writer* cfw, const void* buf, size_t len)
+{
+	if (fwrite(buf, 1, len, cfw->fp) != len){
+		perror("acqcf write");
+		return -1;
+	}
+	cfw->offset += len;
+	return 0;
+}
+
+struct ACQCF_Writer* acqcfOpenWriter(FILE* fp, const struct ACQCF_Header* hdr)
+{
+	struct ACQCF_Writer* cfw = calloc(1, sizeof(struct ACQCF_Writer));
+
+	cfw->fp = fp;
+	cfw->hdr = *hdr;
+	cfw->hdr.magic = ACQCF_MAGIC;
+	cfw->hdr.version = ACQCF_VERSION;
+	if (cfw->hdr.chunk_records == 0){
+		cfw->hdr.chunk_records = ACQCF_CHUNK_RECORDS;
+	}
+	if (cfw->hdr.chunk_records > ACQCF_MAX_CHUNK_RECORDS ||
+	    cfw->hdr.record_words > ACQCF_MAX_RECORD_WORDS){
+		fprintf(stderr, "ERROR: container chunk %u x %u LW too big\n",
+			cfw->hdr.chunk_records, cfw->hdr.record_words);
+		free(cfw);
+		return 0;
+	}
+	cfw->chunk = malloc(cfw->hdr.chunk_records *
+				cfw->hdr.record_words * sizeof(unsigned));
+	cfw->maxchunks = 1024;
+	cfw->index = malloc(cfw->maxchunks * sizeof(struct ACQCF_IndexEntry));
+
+	if (cfwrite(cfw, &cfw->hdr, sizeof(cfw->hdr))){
+		free(cfw->index);
+		free(cfw->chunk);
+		free(cfw);
+		return 0;
+	}
+	return cfw;
+}
+
+static int flushChunk(struct ACQCF_Writer* cfw)
+{
+	size_t len = cfw->ch.nrecords * cfw->hdr.record_words * sizeof(unsigned);
+
+	if (cfw->ch.nrecords == 0){
+		return 0;
+	}
+	if (cfw->nchunks == cfw->maxchunks){
+		cfw->maxchunks *= 2;
+		cfw->index = realloc(cfw->index,
+			cfw->maxchunks * sizeof(struct ACQCF_IndexEntry));
+	}
+	cfw->index[cfw->nchunks].first_sample = cfw->ch.first_sample;
+	cfw->index[cfw->nchunks].offset = cfw->offset;
+	cfw->nchunks++;
+
+	cfw->ch.magic = ACQCF_CHUNK_MAGIC;
+	cfw->ch.crc = acqkCrc32(0, cfw->chunk, len);
+	if (cfwrite(cfw, &cfw->ch, sizeof(cfw->ch)) ||
+	    cfwrite(cfw, cfw->chunk, len)){
+		return -1;
+	}
+	cfw->ch.nrecords = 0;
+	return 0;
+}
+
+int acqcfWrite(struct ACQCF_Writer* cfw, const unsigned* record,
+		unsigned long long sample, unsigned sc)
+{
+	unsigned rw = cfw->hdr.record_words;
+
+	if (cfw->ch.nrecords == 0){
+		cfw->ch.first_sample = sample;
+		cfw->ch.first_sc = sc;
+	}
+	memcpy(cfw->chunk + cfw->ch.nrecords*rw, record, rw*sizeof(unsigned));
+	if (++cfw->ch.nrecords == cfw->hdr.chunk_records){
+		return flushChunk(cfw);
+	}
+	return 0;
+}
+
+int acqcfClose(struct ACQCF_Writer* cfw)
+{
+	struct ACQCF_Trailer tr;
+	int rc = flushChunk(cfw);
+
+	tr.magic = ACQCF_TRAILER_MAGIC;
+	tr.nchunks = cfw->nchunks;
+	tr.index_offset = cfw->offset;
+
+	if (rc == 0){
+		rc = cfwrite(cfw, cfw->index,
+			cfw->nchunks * sizeof(struct ACQCF_IndexEntry));
+	}
+	if (rc == 0){
+		rc = cfwrite(cfw, &tr, sizeof(tr));
+	}
+	fflush(cfw->fp);
+	free(cfw->index);
+	free(cfw->chunk);
+	free(cfw);
+	return rc;
+}
+
+struct ACQCF_Reader* acqcfOpenReader(FILE* fp)
+{
+	struct ACQCF_Reader* cfr;
+	off_t pos0 = ftello(fp);
+	off_t fsize;
+	off_t data0;
+	unsigned long long fit;
+
+	/* not seekable: nothing read, so the caller still has the data */
+	if (pos0 < 0 || fseeko(fp, 0, SEEK_END) != 0 ||
+	    (fsize = ftello(fp)) < 0 || fseeko(fp, pos0, SEEK_SET) != 0){
+		return 0;
+	}
+	if ((cfr = calloc(1, sizeof(struct ACQCF_Reader))) == 0){
+		perror("acqcf");
+		return 0;
+	}
+	if (fread(&cfr->hdr, sizeof(cfr->hdr), 1, fp) != 1 ||
+	    cfr->hdr.magic != ACQCF_MAGIC ||
+	    cfr->hdr.version != ACQCF_VERSION ||
+	    cfr->hdr.record_words == 0){
+		fseeko(fp, pos0, SEEK_SET);
+		free(cfr);
+		return 0;
+	}
+	if (cfr->hdr.chunk_records == 0 ||
+	    cfr->hdr.chunk_records > ACQCF_MAX_CHUNK_RECORDS ||
+	    cfr->hdr.record_words > ACQCF_MAX_RECORD_WORDS){
+		fprintf(stderr, "ERROR: container chunk %u x %u LW out of range\n",
+			cfr->hdr.chunk_records, cfr->hdr.record_words);
+		fseeko(fp, pos0, SEEK_SET);
+		free(cfr);
+		return 0;
+	}
+	cfr->fp = fp;
+
+	/* no bigger than the records the file can hold: a short capture
+	 * uses part of one chunk, a bad header can't ask for gigabytes */
+	data0 = pos0 + sizeof(cfr->hdr);
+	fit = fsize > data0 + (off_t)sizeof(cfr->ch)?
+		(unsigned long long)(fsize - data0 - sizeof(cfr->ch)) /
+			(cfr->hdr.record_words * sizeof(unsigned)): 0;
+	cfr->chunk_cap = fit < cfr->hdr.chunk_records?
+				(unsigned)fit: cfr->hdr.chunk_records;
+	/* +1: never malloc(0) */
+	cfr->chunk = malloc(((size_t)cfr->chunk_cap + 1) *
+				cfr->hdr.record_words * sizeof(unsigned));
+	if (cfr->chunk == 0){
+		perror("acqcf chunk");
+		fseeko(fp, pos0, SEEK_SET);
+		free(cfr);
+		return 0;
+	}
+
+	/* index is optional: a truncated file can still be read. The
+	 * trailer must describe an index that lies between the header
+	 * and itself, else it is ignored */
+	if (fseeko(fp, -(off_t)sizeof(cfr->tr), SEEK_END) == 0 &&
+	    fread(&cfr->tr, sizeof(cfr->tr), 1, fp) == 1 &&
+	    cfr->tr.magic == ACQCF_TRAILER_MAGIC &&
+	    cfr->tr.index_offset >= (unsigned long long)data0 &&
+	    cfr->tr.index_offset <= (unsigned long long)fsize - sizeof(cfr->tr) &&
+	    cfr->tr.nchunks <= ((unsigned long long)fsize - sizeof(cfr->tr) -
+			cfr->tr.index_offset) / sizeof(struct ACQCF_IndexEntry) &&
+	    fseeko(fp, cfr->tr.index_offset, SEEK_SET) == 0){
+		cfr->index = malloc((cfr->tr.nchunks+1) *
+					sizeof(struct ACQCF_IndexEntry));
+		if (cfr->index == 0 ||
+		    fread(cfr->index, sizeof(struct ACQCF_IndexEntry),
+				cfr->tr.nchunks, fp) != cfr->tr.nchunks){
+			free(cfr->index);
+			cfr->index = 0;
+		}
+	}
+	fseeko(fp, data0, SEEK_SET);
+	return cfr;
+}
+
+const struct ACQCF_Header* acqcfHeader(struct ACQCF_Reader* cfr)
+{
+	return &cfr->hdr;
+}
+
+static int loadChunk(struct ACQCF_Reader* cfr)
+{
+	size_t nw;
+
+	if (cfr->index && ftello(cfr->fp) >= (off_t)cfr->tr.index_offset){
+		return 0;
+	}
+	if (fread(&cfr->ch, sizeof(cfr->ch), 1, cfr->fp) != 1 ||
+	    cfr->ch.magic != ACQCF_CHUNK_MAGIC){
+		return 0;
+	}
+	if (cfr->ch.nrecords > cfr->hdr.chunk_records){
+		fprintf(stderr, "ERROR: acqcf chunk at %llu bad nrecords %u\n",
+				cfr->ch.first_sample, cfr->ch.nrecords);
+		return -1;
+	}
+	nw = cfr->ch.nrecords * cfr->hdr.record_words;
+	if (cfr->ch.nrecords > cfr->chunk_cap ||
+	    fread(cfr->chunk, sizeof(unsigned), nw, cfr->fp) != nw){
+		fprintf(stderr, "ERROR: acqcf chunk at %llu truncated\n",
+				cfr->ch.first_sample);
+		return -1;
+	}
+	if (acqkCrc32(0, cfr->chunk, nw*sizeof(unsigned)) != cfr->ch.crc){
+		fprintf(stderr, "ERROR: acqcf chunk at %llu crc\n",
+				cfr->ch.first_sample);
+		return -1;
+	}
+	cfr->cursor = 0;
+	return 1;
+}
+
+unsigned long long acqcfSamples(struct ACQCF_Reader* cfr)
+{
+	struct ACQCF_Chunk last;
+	off_t here;
+
+	if (!cfr->index || cfr->tr.nchunks == 0){
+		return 0;
+	}
+	here = ftello(cfr->fp);
+	fseeko(cfr->fp, cfr->index[cfr->tr.nchunks-1].offset, SEEK_SET);
+	if (fread(&last, sizeof(last), 1, cfr->fp) != 1){
+		last.nrecords = 0;
+	}
+	fseeko(cfr->fp, here, SEEK_SET);
+	return cfr->index[cfr->tr.nchunks-1].first_sample + last.nrecords;
+}
+
+int acqcfSeek(struct ACQCF_Reader* cfr, unsigned long long sample)
+{
+	int lo = 0;
+	int hi;
+
+	if (!cfr->index || cfr->tr.nchunks == 0){
+		return -1;
+	}
+	/* last chunk with first_sample <= sample */
+	hi = cfr->tr.nchunks - 1;
+	while (lo < hi){
+		int mid = (lo + hi + 1) / 2;
+		if (cfr->index[mid].first_sample <= sample){
+			lo = mid;
+		}else{
+			hi = mid - 1;
+		}
+	}
+	if (fseeko(cfr->fp, cfr->index[lo].offset, SEEK_SET) != 0 ||
+	    loadChunk(cfr) != 1){
+		return -1;
+	}
+	if (sample < cfr->ch.first_sample ||
+	    sample >= cfr->ch.first_sample + cfr->ch.nrecords){
+		return -1;
+	}
+	cfr->cursor = sample - cfr->ch.first_sample;
+	return 0;
+}
+
+int acqcfRead(struct ACQCF_Reader* cfr, unsigned* record)
+{
+	unsigned rw = cfr->hdr.record_words;
+
+	while (cfr->cursor >= cfr->ch.nrecords){
+		int rc = loadChunk(cfr);
+		if (rc != 1){
+			cfr->ch.nrecords = 0;
+			return rc;
+		}
+	}
+	memcpy(record, cfr->chunk + cfr->cursor*rw, rw*sizeof(unsigned));
+	cfr->cursor++;
+	return 1;
+}
+
+void acqcfCloseReader(struct ACQCF_Reader* cfr)
+{
+	free(cfr->index);
+	free(cfr->chunk);
+	free(cfr);
+}
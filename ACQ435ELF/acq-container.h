@@ -0,0 +1,122 @@
+/* ------------------------------------------------------------------------- */
+/* acq-container.h - chunked, indexed container for validated output        */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * File    : HEADER CHUNK* INDEX TRAILER
+ * HEADER  : struct ACQCF_Header, self describing
+ * CHUNK   : struct ACQCF_Chunk, then nrecords * record_words LW
+ * INDEX   : struct ACQCF_IndexEntry[nchunks], sorted by first_sample
+ * TRAILER : struct ACQCF_Trailer, fixed size at end of file
+ *
+ * A record is one output frame, first_sample counts records from 0.
+ */
+
+#ifndef __ACQ_CONTAINER_H__
+#define __ACQ_CONTAINER_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define ACQCF_MAGIC		0x46433341	/* "A3CF" */
+#define ACQCF_CHUNK_MAGIC	0x4b484341	/* "ACHK" */
+#define ACQCF_TRAILER_MAGIC	0x58444941	/* "AIDX" */
+#define ACQCF_VERSION		1
+
+#define ACQCF_CHUNK_RECORDS	4096		/* default */
+#define ACQCF_MAX_CHUNK_RECORDS	0x100000	/* sanity limits on open */
+#define ACQCF_MAX_RECORD_WORDS	4096
+
+enum ACQCF_COLS {
+	ACQCF_RAW = 1,			/* validated frame, unchanged */
+	ACQCF_TWO_COLUMN = 2,		/* sc, value per selected channel */
+	ACQCF_SHARED_SC = 3		/* sc, then value per selected channel */
+};
+
+struct ACQCF_Header {
+	unsigned magic;
+	unsigned version;
+	unsigned nchan;			/* channels per record */
+	unsigned ncols;			/* enum ACQCF_COLS */
+	unsigned record_words;		/* LW per record */
+	unsigned chunk_records;
+	unsigned spare[2];
+	char sites[256];		/* site definitions, space separated */
+	char mask[128];			/* channel mask definition */
+};
+
+struct ACQCF_Chunk {
+	unsigned magic;
+	unsigned nrecords;
+	unsigned crc;			/* crc32 of the record data */
+	unsigned first_sc;		/* bitslice sample count, first record */
+	unsigned long long first_sample;
+};
+
+struct ACQCF_IndexEntry {
+	unsigned long long first_sample;
+	unsigned long long offset;	/* file offset of ACQCF_Chunk */
+};
+
+struct ACQCF_Trailer {
+	unsigned magic;
+	unsigned nchunks;
+	unsigned long long index_offset;
+};
+
+struct ACQCF_Writer;
+struct ACQCF_Reader;
+
+struct ACQCF_Writer* acqcfOpenWriter(FILE* fp, const struct ACQCF_Header* hdr);
+/** writes header. hdr->chunk_records == 0 selects default */
+
+int acqcfWrite(struct ACQCF_Writer* cfw, const unsigned* record,
+		unsigned long long sample, unsigned sc);
+/** append one record of hdr->record_words. returns 0 on success */
+
+int acqcfClose(struct ACQCF_Writer* cfw);
+/** flush last chunk, write index and trailer. frees cfw */
+
+struct ACQCF_Reader* acqcfOpenReader(FILE* fp);
+/** returns 0 and restores the position of fp if fp is not a container.
+ *  fp must be seekable: a pipe is never taken as a container */
+
+const struct ACQCF_Header* acqcfHeader(struct ACQCF_Reader* cfr);
+
+unsigned long long acqcfSamples(struct ACQCF_Reader* cfr);
+/** total records in file, from the index */
+
+int acqcfSeek(struct ACQCF_Reader* cfr, unsigned long long sample);
+/** position at record sample, binary search on index. 0 on success */
+
+int acqcfRead(struct ACQCF_Reader* cfr, unsigned* record);
+/** read next record. returns 1 on success, 0 at end, -1 on chunk error */
+
+void acqcfCloseReader(struct ACQCF_Reader* cfr);
+/** frees cfr, does not close fp */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_CONTAINER_H__ */
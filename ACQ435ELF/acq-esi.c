@@ -0,0 +1,155 @@
+/* ------------------------------------------------------------------------- */
+/* acq-esi.c - ES index sidecar                                              */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "acq-esi.h"
+#include "acq-kernels.h"
+
+#define ES_MASK		0xfffffff0
+#define ES_MAGIC	0xaa55f150
+
+int acqEsiIsES(const unsigned* frame)
+{
+	return (frame[0]&ES_MASK) == ES_MAGIC && (frame[1]&ES_MASK) == ES_MAGIC &&
+	       (frame[2]&ES_MASK) == ES_MAGIC && (frame[3]&ES_MASK) == ES_MAGIC;
+}
+
+int acqEsiScan(const void* data, unsigned long long len, int frame_bytes,
+		struct AcqEsiEntry** entries)
+{
+	const char* base = (const char*)data;
+	const long nframes = len / frame_bytes;
+	long ifr = 0;
+	int nes = 0;
+	int maxes = 1024;
+
+	if ((*entries = malloc(maxes * sizeof(struct AcqEsiEntry))) == 0){
+		perror("acqEsiScan");
+		return -1;
+	}
+	while ((ifr += acqkFindES((const unsigned*)(base + ifr*frame_bytes),
+			nframes - ifr, frame_bytes/sizeof(unsigned),
+			ES_MAGIC, ES_MASK)) < nframes){
+		unsigned long long offset = (unsigned long long)ifr * frame_bytes;
+		const unsigned* frame = (const unsigned*)(base + offset);
+		if (nes == maxes){
+			struct AcqEsiEntry* more = realloc(*entries,
+					2 * maxes * sizeof(struct AcqEsiEntry));
+			if (more == 0){
+				perror("acqEsiScan");
+				free(*entries);
+				*entries = 0;
+				return -1;
+			}
+			*entries = more;
+			maxes *= 2;
+		}
+		(*entries)[nes].offset = offset;
+		(*entries)[nes].sample = frame_bytes > 16? frame[4]: 0;
+		(*entries)[nes].spare = 0;
+		++nes;
+		++ifr;
+	}
+	return nes;
+}
+
+static FILE* open_sidecar(const char* fname, const char* mode)
+{
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s.esi", fname);
+	return fopen(path, mode);
+}
+
+int acqEsiLoad(const char* fname, int frame_bytes,
+		unsigned long long file_bytes, struct AcqEsiEntry** entries)
+{
+	struct AcqEsiHeader hdr;
+	struct stat sb;
+	FILE* fp = open_sidecar(fname, "r");
+	int nes = -1;
+
+	if (!fp){
+		return -1;
+	}
+	/* a count that neither the sidecar nor the data file could hold
+	 * is corrupt: treat as stale */
+	if (fstat(fileno(fp), &sb) == 0 &&
+	    fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	    memcmp(hdr.magic, ACQESI_MAGIC, 4) == 0 &&
+	    hdr.version == ACQESI_VERSION &&
+	    hdr.frame_bytes == frame_bytes && hdr.file_bytes == file_bytes &&
+	    hdr.nes <= (sb.st_size - sizeof(hdr)) / sizeof(struct AcqEsiEntry) &&
+	    hdr.nes <= file_bytes / frame_bytes && hdr.nes <= INT_MAX &&
+	    (*entries = malloc((hdr.nes+1) * sizeof(struct AcqEsiEntry))) != 0){
+		if (fread(*entries, sizeof(struct AcqEsiEntry), hdr.nes, fp)
+								== hdr.nes){
+			nes = hdr.nes;
+		}else{
+			free(*entries);
+			*entries = 0;
+		}
+	}
+	fclose(fp);
+	return nes;
+}
+
+int acqEsiSave(const char* fname, int frame_bytes,
+		unsigned long long file_bytes,
+		const struct AcqEsiEntry* entries, int nes)
+{
+	struct AcqEsiHeader hdr = {};
+	FILE* fp = open_sidecar(fname, "w");
+	int rc = 0;
+
+	if (!fp){
+		perror("acqEsiSave");
+		return -1;
+	}
+	memcpy(hdr.magic, ACQESI_MAGIC, 4);
+	hdr.version = ACQESI_VERSION;
+	hdr.frame_bytes = frame_bytes;
+	hdr.nes = nes;
+	hdr.file_bytes = file_bytes;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(entries, sizeof(struct AcqEsiEntry), nes, fp) != nes){
+		rc = -1;
+	}
+	if (fclose(fp) != 0){
+		rc = -1;
+	}
+	return rc;
+}
+
+int acqEsiGet(const char* fname, const void* data, unsigned long long len,
+		int frame_bytes, struct AcqEsiEntry** entries)
+{
+	int nes = acqEsiLoad(fname, frame_bytes, len, entries);
+
+	if (nes < 0){
+		nes = acqEsiScan(data, len, frame_bytes, entries);
+	}
+	return nes;
+}
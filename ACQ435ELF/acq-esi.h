@@ -0,0 +1,76 @@
+/* ------------------------------------------------------------------------- */
+/* acq-esi.h - ES index sidecar: FILE.esi lists the ES frames in FILE        */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * FILE.esi : header, then one entry per ES frame, in file order.
+ * The index is stale, and ignored, if the frame size or file size differ.
+ * ES frames are detected as acq435_es_validator does: the first four
+ * words are 0xaa55f15x.
+ */
+
+#ifndef __ACQ_ESI_H__
+#define __ACQ_ESI_H__
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define ACQESI_MAGIC	"AESI"
+#define ACQESI_VERSION	1
+
+struct AcqEsiHeader {
+	char magic[4];
+	unsigned version;
+	unsigned frame_bytes;
+	unsigned nes;
+	unsigned long long file_bytes;
+};
+
+struct AcqEsiEntry {
+	unsigned long long offset;	/* bytes, start of the ES frame */
+	unsigned sample;		/* sample count embedded in the ES */
+	unsigned spare;
+};
+
+int acqEsiIsES(const unsigned* frame);
+
+int acqEsiScan(const void* data, unsigned long long len, int frame_bytes,
+		struct AcqEsiEntry** entries);
+/** finds ES frames at frame boundaries. returns count, *entries malloc'd,
+ *  or -1 when out of memory */
+
+int acqEsiLoad(const char* fname, int frame_bytes,
+		unsigned long long file_bytes, struct AcqEsiEntry** entries);
+/** reads fname.esi. returns count, or -1 when missing or stale */
+
+int acqEsiSave(const char* fname, int frame_bytes,
+		unsigned long long file_bytes,
+		const struct AcqEsiEntry* entries, int nes);
+/** writes fname.esi, returns 0 on success */
+
+int acqEsiGet(const char* fname, const void* data, unsigned long long len,
+		int frame_bytes, struct AcqEsiEntry** entries);
+/** from the sidecar when current, else by scanning data */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_ESI_H__ */
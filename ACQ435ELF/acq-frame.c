@@ -0,0 +1,263 @@
+/* ------------------------------------------------------------------------- */
+/* acq-frame.c - buffered frame reader with resynchronisation               */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "acq-frame.h"
+#include "acq-kernels.h"
+#include "acq-numa.h"
+
+#define READ_FRAMES	256
+
+struct AcqFrameReader {
+	int fd;
+	int frame_bytes;
+	char* buf;
+	int size;
+	int rd;			/* next frame */
+	int wr;			/* end of data */
+	int last;		/* start of the last frame returned */
+	int eof;
+	/* follow mode, see acqfrFollow() */
+	int follow;
+	int ifd;		/* inotify, -1: poll the file */
+	int closing;		/* writer done: one more read, then EOF */
+	int poll_ms;
+	int idle_s;
+	const char* end_marker;
+	time_t last_data;
+};
+
+int acqfrResyncEnabled(void)
+{
+	return getenv("RESYNC") && atoi(getenv("RESYNC"));
+}
+
+struct AcqFrameReader* acqfrCreate(FILE* fp, int frame_bytes)
+{
+	struct AcqFrameReader* fr = calloc(1, sizeof(struct AcqFrameReader));
+
+	fr->fd = fileno(fp);
+	fr->frame_bytes = frame_bytes;
+	fr->size = frame_bytes * READ_FRAMES;
+	fr->buf = acqAlloc(fr->size);
+	fr->ifd = -1;
+	return fr;
+}
+
+int acqfrFollow(struct AcqFrameReader* fr, const char* path)
+{
+	fr->follow = 1;
+	fr->poll_ms = getenv("FOLLOW_POLL")? atoi(getenv("FOLLOW_POLL")): 100;
+	fr->idle_s = getenv("FOLLOW_IDLE")? atoi(getenv("FOLLOW_IDLE")): 0;
+	fr->end_marker = getenv("FOLLOW_END");
+	fr->last_data = time(0);
+
+	fr->ifd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fr->ifd >= 0 &&
+	    inotify_add_watch(fr->ifd, path, IN_MODIFY|IN_CLOSE_WRITE) < 0){
+		close(fr->ifd);
+		fr->ifd = -1;
+	}
+	return fr->ifd >= 0;
+}
+
+/* at the end of the data in follow mode: wait for the file to grow.
+ * returns 0 when the writer is done */
+static int follow_wait(struct AcqFrameReader* fr)
+{
+	struct stat sb;
+
+	if (fr->closing){
+		return 0;
+	}
+	/* whatever was validated so far is visible before we sleep */
+	fflush(stdout);
+
+	if (fr->ifd >= 0){
+		struct pollfd pfd = { fr->ifd, POLLIN, 0 };
+		char events[4096];
+		int nr;
+
+		poll(&pfd, 1, fr->poll_ms);
+		while ((nr = read(fr->ifd, events, sizeof(events))) > 0){
+			char* ev = events;
+			while (ev < events + nr){
+				struct inotify_event* ie = (struct inotify_event*)ev;
+				if (ie->mask & IN_CLOSE_WRITE){
+					fr->closing = 1;
+				}
+				ev += sizeof(struct inotify_event) + ie->len;
+			}
+		}
+	}else{
+		poll(0, 0, fr->poll_ms);
+	}
+	if (fr->end_marker && stat(fr->end_marker, &sb) == 0){
+		fr->closing = 1;
+	}
+	if (fr->idle_s && time(0) - fr->last_data >= fr->idle_s){
+		fr->closing = 1;
+	}
+	return 1;
+}
+
+void acqfrDelete(struct AcqFrameReader* fr)
+{
+	if (fr->ifd >= 0){
+		close(fr->ifd);
+	}
+	acqFree(fr->buf, fr->size);
+	free(fr);
+}
+
+/* move unread data to the (aligned) start of the buffer */
+static void compact(struct AcqFrameReader* fr)
+{
+	memmove(fr->buf, fr->buf + fr->rd, fr->wr - fr->rd);
+	fr->wr -= fr->rd;
+	fr->rd = 0;
+	fr->last = -1;
+}
+
+static void grow(struct AcqFrameReader* fr, int size)
+{
+	char* buf = acqAlloc(size);
+
+	memcpy(buf, fr->buf + fr->rd, fr->wr - fr->rd);
+	acqFree(fr->buf, fr->size);
+	fr->buf = buf;
+	fr->size = size;
+	fr->wr -= fr->rd;
+	fr->rd = 0;
+	fr->last = -1;
+}
+
+/* returns 1 when need bytes are available at rd */
+static int ensure(struct AcqFrameReader* fr, int need)
+{
+	if (fr->wr - fr->rd >= need){
+		return 1;
+	}
+	if (fr->rd + need > fr->size){
+		compact(fr);
+	}
+	while (fr->wr - fr->rd < need && !fr->eof){
+		int nr = read(fr->fd, fr->buf + fr->wr, fr->size - fr->wr);
+		if (nr < 0 && errno == EINTR){
+			continue;
+		}else if (nr == 0 && fr->follow && follow_wait(fr)){
+			continue;
+		}else if (nr <= 0){
+			fr->eof = 1;
+		}else{
+			fr->wr += nr;
+			fr->last_data = time(0);
+		}
+	}
+	return fr->wr - fr->rd >= need;
+}
+
+const unsigned* acqfrPeek(struct AcqFrameReader* fr, int nbytes, int* got)
+{
+	if (fr->size < nbytes){
+		grow(fr, nbytes);
+	}
+	if (fr->rd & 3){
+		compact(fr);
+	}
+	ensure(fr, nbytes);
+	*got = fr->wr - fr->rd < nbytes? fr->wr - fr->rd: nbytes;
+	return (const unsigned*)(fr->buf + fr->rd);
+}
+
+void acqfrSkip(struct AcqFrameReader* fr, int nbytes)
+{
+	if (ensure(fr, nbytes)){
+		fr->rd += nbytes;
+	}else{
+		fr->rd = fr->wr;
+	}
+}
+
+void acqfrSetFrameBytes(struct AcqFrameReader* fr, int frame_bytes)
+{
+	fr->frame_bytes = frame_bytes;
+	if (fr->size < frame_bytes * READ_FRAMES){
+		grow(fr, frame_bytes * READ_FRAMES);
+	}
+}
+
+const unsigned* acqfrNext(struct AcqFrameReader* fr)
+{
+	if (fr->rd & 3){
+		/* locked at an odd byte, realign the data once */
+		compact(fr);
+	}
+	if (!ensure(fr, fr->frame_bytes)){
+		return 0;
+	}
+	fr->last = fr->rd;
+	fr->rd += fr->frame_bytes;
+	return (const unsigned*)(fr->buf + fr->last);
+}
+
+long long acqfrResync(struct AcqFrameReader* fr,
+		AcqFrameMatch match, void* ctx,
+		unsigned char id0, unsigned char mask0)
+{
+	const int fb = fr->frame_bytes;
+	long long skipped = 1;
+
+	id0 &= mask0;
+	fr->rd = fr->last + 1;
+	fr->last = -1;
+
+	while (ensure(fr, 2*fb)){
+		int len = fr->wr - fr->rd - 2*fb + 1;
+		int hit = acqkScanId((unsigned char*)fr->buf + fr->rd, len,
+					id0, mask0);
+
+		fr->rd += hit;
+		skipped += hit;
+		if (hit == len){
+			continue;
+		}
+		if (fr->rd & 3){
+			compact(fr);
+		}
+		if (match((unsigned*)(fr->buf + fr->rd), ctx) &&
+		    match((unsigned*)(fr->buf + fr->rd + fb), ctx)){
+			return skipped;
+		}
+		fr->rd += 1;
+		skipped += 1;
+	}
+	fr->rd = fr->wr;
+	return -1;
+}
@@ -0,0 +1,85 @@
+/* ------------------------------------------------------------------------- */
+/* acq-frame.h - buffered frame reader with resynchronisation               */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Frames are read from the fd in blocks; after an error the reader can
+ * be wound back to the byte after the start of the bad frame and search
+ * forward for the first frame whose channel IDs match, at any byte offset.
+ *
+ * env:
+ * RESYNC=1     tools using the reader resync after an ID error
+ *
+ * follow mode, acqfrFollow():
+ * FOLLOW_POLL=ms     wait for more data [100]
+ * FOLLOW_END=FILE    the writer is done once FILE exists
+ * FOLLOW_IDLE=s      the writer is done after s seconds with no new data
+ */
+
+#ifndef __ACQ_FRAME_H__
+#define __ACQ_FRAME_H__
+
+#include <stdio.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+struct AcqFrameReader;
+
+typedef int (*AcqFrameMatch)(const unsigned* frame, void* ctx);
+/** pure check, returns 1 if frame IDs match the layout */
+
+struct AcqFrameReader* acqfrCreate(FILE* fp, int frame_bytes);
+
+void acqfrDelete(struct AcqFrameReader* fr);
+
+const unsigned* acqfrPeek(struct AcqFrameReader* fr, int nbytes, int* got);
+/** up to nbytes of unread data, without consuming it. got: bytes available */
+
+void acqfrSkip(struct AcqFrameReader* fr, int nbytes);
+
+void acqfrSetFrameBytes(struct AcqFrameReader* fr, int frame_bytes);
+/** eg once the layout of peeked data is known */
+
+const unsigned* acqfrNext(struct AcqFrameReader* fr);
+/** next whole frame, word aligned, or 0 at EOF */
+
+long long acqfrResync(struct AcqFrameReader* fr,
+		AcqFrameMatch match, void* ctx,
+		unsigned char id0, unsigned char mask0);
+/** search forward from the last frame returned for two consecutive
+ *  matching frames, where byte 0 of a candidate satisfies
+ *  (byte & mask0) == id0. Returns bytes from the start of the last frame
+ *  to the start of the new lock, the next acqfrNext() returns the locked
+ *  frame. Returns -1 if the input ended before lock. */
+
+int acqfrResyncEnabled(void);
+
+int acqfrFollow(struct AcqFrameReader* fr, const char* path);
+/** at end of data wait for path to grow instead of EOF, until the writer
+ *  closes it (inotify IN_CLOSE_WRITE), FOLLOW_END or FOLLOW_IDLE.
+ *  Only complete frames are returned. Returns 1 with inotify, 0 when
+ *  the file is polled every FOLLOW_POLL ms (eg NFS) */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_FRAME_H__ */
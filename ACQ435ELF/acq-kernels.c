@@ -0,0 +1,529 @@
+/* ------------------------------------------------------------------------- */
+/* acq-kernels.c - hot loops built per ISA, chosen at startup               */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ACQK_X86
+#include <immintrin.h>
+#endif
+
+#include "acq-kernels.h"
+
+/* scalar: the reference for every other version */
+
+static unsigned id_check_scalar(const unsigned* frame, const unsigned* idm,
+		const unsigned* mask, int nwords)
+{
+	unsigned diff = 0;
+	int iw;
+	for (iw = 0; iw < nwords; ++iw){
+		diff |= (frame[iw] & mask[iw]) ^ idm[iw];
+	}
+	return diff;
+}
+
+static long find_es_scalar(const unsigned* data, long nframes, int frame_words,
+		unsigned magic, unsigned mask)
+{
+	long ifr;
+	magic &= mask;
+	for (ifr = 0; ifr < nframes; ++ifr, data += frame_words){
+		if ((data[0]&mask) == magic && (data[1]&mask) == magic &&
+		    (data[2]&mask) == magic && (data[3]&mask) == magic){
+			break;
+		}
+	}
+	return ifr;
+}
+
+static unsigned collect_bits_scalar(const unsigned* data, int bit)
+{
+	unsigned xx = 0;
+	int iw;
+	for (iw = 0; iw < 32; ++iw){
+		xx |= (data[iw] >> bit & 1) << iw;
+	}
+	return xx;
+}
+
+static int scan_id_scalar(const unsigned char* p, int len,
+		unsigned char id, unsigned char mask)
+{
+	int ib;
+	for (ib = 0; ib < len; ++ib){
+		if ((p[ib] & mask) == id){
+			break;
+		}
+	}
+	return ib;
+}
+
+static void extract24_scalar(const unsigned* frame, const int* words, int n,
+		int* xx)
+{
+	int ic;
+	for (ic = 0; ic < n; ++ic){
+		xx[ic] = (int)frame[words[ic]] >> 8;
+	}
+}
+
+/* one version: packing ORs each value into one or two words that depend
+ * on w, and no ISA here has an OR scatter to do that a vector at a time */
+static void pack32_scalar(const unsigned* in, unsigned* out, int w)
+{
+	int ii, bit;
+
+	if (w == 0) return;
+	if (w == 32){
+		memcpy(out, in, 32*sizeof(unsigned));
+		return;
+	}
+	memset(out, 0, w*sizeof(unsigned));
+	for (ii = 0, bit = 0; ii < 32; ++ii, bit += w){
+		int iw = bit >> 5;
+		int sh = bit & 31;
+		out[iw] |= in[ii] << sh;
+		if (sh + w > 32){
+			out[iw+1] |= in[ii] >> (32 - sh);
+		}
+	}
+}
+
+static void unpack32_scalar(const unsigned* in, unsigned* out, int w)
+{
+	unsigned mask;
+	int ii, bit;
+
+	if (w == 0){
+		memset(out, 0, 32*sizeof(unsigned));
+		return;
+	}
+	if (w == 32){
+		memcpy(out, in, 32*sizeof(unsigned));
+		return;
+	}
+	mask = (1U << w) - 1;
+	for (ii = 0, bit = 0; ii < 32; ++ii, bit += w){
+		int iw = bit >> 5;
+		int sh = bit & 31;
+		unsigned xx = in[iw] >> sh;
+		if (sh + w > 32){
+			xx |= in[iw+1] << (32 - sh);
+		}
+		out[ii] = xx & mask;
+	}
+}
+
+#ifdef ACQK_X86
+
+__attribute__((target("sse2")))
+static unsigned id_check_sse2(const unsigned* frame, const unsigned* idm,
+		const unsigned* mask, int nwords)
+{
+	__m128i diff = _mm_setzero_si128();
+	unsigned dd[4];
+	int iw = 0;
+
+	for (; iw + 4 <= nwords; iw += 4){
+		__m128i xx = _mm_loadu_si128((const __m128i*)(frame + iw));
+		__m128i mm = _mm_loadu_si128((const __m128i*)(mask + iw));
+		__m128i id = _mm_loadu_si128((const __m128i*)(idm + iw));
+		diff = _mm_or_si128(diff, _mm_xor_si128(_mm_and_si128(xx, mm), id));
+	}
+	_mm_storeu_si128((__m128i*)dd, diff);
+	return dd[0] | dd[1] | dd[2] | dd[3] |
+		id_check_scalar(frame + iw, idm + iw, mask + iw, nwords - iw);
+}
+
+__attribute__((target("avx2")))
+static unsigned id_check_avx2(const unsigned* frame, const unsigned* idm,
+		const unsigned* mask, int nwords)
+{
+	__m256i diff = _mm256_setzero_si256();
+	unsigned dd[4];
+	int iw = 0;
+
+	for (; iw + 8 <= nwords; iw += 8){
+		__m256i xx = _mm256_loadu_si256((const __m256i*)(frame + iw));
+		__m256i mm = _mm256_loadu_si256((const __m256i*)(mask + iw));
+		__m256i id = _mm256_loadu_si256((const __m256i*)(idm + iw));
+		diff = _mm256_or_si256(diff,
+			_mm256_xor_si256(_mm256_and_si256(xx, mm), id));
+	}
+	_mm_storeu_si128((__m128i*)dd, _mm_or_si128(
+		_mm256_castsi256_si128(diff), _mm256_extracti128_si256(diff, 1)));
+	return dd[0] | dd[1] | dd[2] | dd[3] |
+		id_check_scalar(frame + iw, idm + iw, mask + iw, nwords - iw);
+}
+
+__attribute__((target("avx512f")))
+static unsigned id_check_avx512(const unsigned* frame, const unsigned* idm,
+		const unsigned* mask, int nwords)
+{
+	__m512i diff = _mm512_setzero_si512();
+	int iw = 0;
+
+	for (; iw < nwords; iw += 16){
+		/* the tail is a masked load, no scalar loop */
+		__mmask16 lanes = nwords - iw >= 16? 0xffff:
+					(1U << (nwords - iw)) - 1;
+		__m512i xx = _mm512_maskz_loadu_epi32(lanes, frame + iw);
+		__m512i mm = _mm512_maskz_loadu_epi32(lanes, mask + iw);
+		__m512i id = _mm512_maskz_loadu_epi32(lanes, idm + iw);
+		diff = _mm512_or_si512(diff,
+			_mm512_xor_si512(_mm512_and_si512(xx, mm), id));
+	}
+	return _mm512_reduce_or_epi32(diff);
+}
+
+/* one compare of the 4 word ES signature per frame */
+__attribute__((target("sse2")))
+static long find_es_sse2(const unsigned* data, long nframes, int frame_words,
+		unsigned magic, unsigned mask)
+{
+	const __m128i vmagic = _mm_set1_epi32(magic & mask);
+	const __m128i vmask = _mm_set1_epi32(mask);
+	long ifr;
+
+	for (ifr = 0; ifr < nframes; ++ifr, data += frame_words){
+		__m128i xx = _mm_loadu_si128((const __m128i*)data);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(
+				_mm_and_si128(xx, vmask), vmagic)) == 0xffff){
+			break;
+		}
+	}
+	return ifr;
+}
+
+/* move the bit to the sign, then one movemask per vector of words */
+__attribute__((target("sse2")))
+static unsigned collect_bits_sse2(const unsigned* data, int bit)
+{
+	const __m128i shift = _mm_cvtsi32_si128(31 - bit);
+	unsigned xx = 0;
+	int iw;
+
+	for (iw = 0; iw < 32; iw += 4){
+		__m128i vv = _mm_sll_epi32(
+			_mm_loadu_si128((const __m128i*)(data + iw)), shift);
+		xx |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(vv)) << iw;
+	}
+	return xx;
+}
+
+__attribute__((target("avx2")))
+static unsigned collect_bits_avx2(const unsigned* data, int bit)
+{
+	const __m128i shift = _mm_cvtsi32_si128(31 - bit);
+	unsigned xx = 0;
+	int iw;
+
+	for (iw = 0; iw < 32; iw += 8){
+		__m256i vv = _mm256_sll_epi32(
+			_mm256_loadu_si256((const __m256i*)(data + iw)), shift);
+		xx |= (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(vv)) << iw;
+	}
+	return xx;
+}
+
+__attribute__((target("avx512f")))
+static unsigned collect_bits_avx512(const unsigned* data, int bit)
+{
+	const __m512i bmask = _mm512_set1_epi32(1U << bit);
+	unsigned lo = _mm512_test_epi32_mask(_mm512_loadu_si512(data), bmask);
+	unsigned hi = _mm512_test_epi32_mask(_mm512_loadu_si512(data+16), bmask);
+	return lo | hi << 16;
+}
+
+__attribute__((target("sse2")))
+static int scan_id_sse2(const unsigned char* p, int len,
+		unsigned char id, unsigned char mask)
+{
+	const __m128i vid = _mm_set1_epi8(id);
+	const __m128i vmask = _mm_set1_epi8(mask);
+	int ib = 0;
+
+	for (; ib + 16 <= len; ib += 16){
+		__m128i vv = _mm_loadu_si128((const __m128i*)(p + ib));
+		int hits = _mm_movemask_epi8(
+			_mm_cmpeq_epi8(_mm_and_si128(vv, vmask), vid));
+		if (hits){
+			return ib + __builtin_ctz(hits);
+		}
+	}
+	return ib + scan_id_scalar(p + ib, len - ib, id, mask);
+}
+
+__attribute__((target("avx2")))
+static int scan_id_avx2(const unsigned char* p, int len,
+		unsigned char id, unsigned char mask)
+{
+	const __m256i vid = _mm256_set1_epi8(id);
+	const __m256i vmask = _mm256_set1_epi8(mask);
+	int ib = 0;
+
+	for (; ib + 32 <= len; ib += 32){
+		__m256i vv = _mm256_loadu_si256((const __m256i*)(p + ib));
+		unsigned hits = _mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_and_si256(vv, vmask), vid));
+		if (hits){
+			return ib + __builtin_ctz(hits);
+		}
+	}
+	return ib + scan_id_scalar(p + ib, len - ib, id, mask);
+}
+
+/* no gather before avx2: the 4 loads are scalar, the shift is not */
+__attribute__((target("sse2")))
+static void extract24_sse2(const unsigned* frame, const int* words, int n,
+		int* xx)
+{
+	int ic = 0;
+
+	for (; ic + 4 <= n; ic += 4){
+		__m128i vv = _mm_set_epi32(frame[words[ic+3]], frame[words[ic+2]],
+				frame[words[ic+1]], frame[words[ic]]);
+		_mm_storeu_si128((__m128i*)(xx + ic), _mm_srai_epi32(vv, 8));
+	}
+	extract24_scalar(frame, words + ic, n - ic, xx + ic);
+}
+
+__attribute__((target("avx2")))
+static void extract24_avx2(const unsigned* frame, const int* words, int n,
+		int* xx)
+{
+	int ic = 0;
+
+	for (; ic + 8 <= n; ic += 8){
+		__m256i idx = _mm256_loadu_si256((const __m256i*)(words + ic));
+		__m256i vv = _mm256_i32gather_epi32((const int*)frame, idx, 4);
+		_mm256_storeu_si256((__m256i*)(xx + ic), _mm256_srai_epi32(vv, 8));
+	}
+	extract24_scalar(frame, words + ic, n - ic, xx + ic);
+}
+
+__attribute__((target("avx512f")))
+static void extract24_avx512(const unsigned* frame, const int* words, int n,
+		int* xx)
+{
+	int ic = 0;
+
+	for (; ic + 16 <= n; ic += 16){
+		__m512i idx = _mm512_loadu_si512(words + ic);
+		__m512i vv = _mm512_i32gather_epi32(idx, frame, 4);
+		_mm512_storeu_si512(xx + ic, _mm512_srai_epi32(vv, 8));
+	}
+	extract24_scalar(frame, words + ic, n - ic, xx + ic);
+}
+
+/* value ii starts at bit ii*w: gather its word and the next, and join
+ * them with per lane shifts. A shift by 32 gives 0, so a value that does
+ * not straddle takes nothing from the next word, and that index is
+ * clamped to w-1 to stay inside in[]. sse2 has no per lane shift */
+__attribute__((target("avx2")))
+static void unpack32_avx2(const unsigned* in, unsigned* out, int w)
+{
+	const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i vmask;
+	const __m256i last = _mm256_set1_epi32(w - 1);
+	const __m256i v31 = _mm256_set1_epi32(31);
+	const __m256i v32 = _mm256_set1_epi32(32);
+	int ii;
+
+	if (w == 0 || w == 32){
+		unpack32_scalar(in, out, w);
+		return;
+	}
+	vmask = _mm256_set1_epi32((1U << w) - 1);
+	for (ii = 0; ii < 32; ii += 8){
+		__m256i bit = _mm256_mullo_epi32(
+			_mm256_add_epi32(step, _mm256_set1_epi32(ii)),
+			_mm256_set1_epi32(w));
+		__m256i iw = _mm256_srli_epi32(bit, 5);
+		__m256i sh = _mm256_and_si256(bit, v31);
+		__m256i iw1 = _mm256_min_epi32(
+			_mm256_add_epi32(iw, _mm256_set1_epi32(1)), last);
+		__m256i lo = _mm256_i32gather_epi32((const int*)in, iw, 4);
+		__m256i hi = _mm256_i32gather_epi32((const int*)in, iw1, 4);
+		__m256i xx = _mm256_or_si256(_mm256_srlv_epi32(lo, sh),
+			_mm256_sllv_epi32(hi, _mm256_sub_epi32(v32, sh)));
+		_mm256_storeu_si256((__m256i*)(out + ii),
+				_mm256_and_si256(xx, vmask));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void unpack32_avx512(const unsigned* in, unsigned* out, int w)
+{
+	const __m512i step = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15);
+	__m512i vmask;
+	const __m512i last = _mm512_set1_epi32(w - 1);
+	const __m512i v31 = _mm512_set1_epi32(31);
+	const __m512i v32 = _mm512_set1_epi32(32);
+	int ii;
+
+	if (w == 0 || w == 32){
+		unpack32_scalar(in, out, w);
+		return;
+	}
+	vmask = _mm512_set1_epi32((1U << w) - 1);
+	for (ii = 0; ii < 32; ii += 16){
+		__m512i bit = _mm512_mullo_epi32(
+			_mm512_add_epi32(step, _mm512_set1_epi32(ii)),
+			_mm512_set1_epi32(w));
+		__m512i iw = _mm512_srli_epi32(bit, 5);
+		__m512i sh = _mm512_and_si512(bit, v31);
+		__m512i iw1 = _mm512_min_epi32(
+			_mm512_add_epi32(iw, _mm512_set1_epi32(1)), last);
+		__m512i lo = _mm512_i32gather_epi32(iw, in, 4);
+		__m512i hi = _mm512_i32gather_epi32(iw1, in, 4);
+		__m512i xx = _mm512_or_si512(_mm512_srlv_epi32(lo, sh),
+			_mm512_sllv_epi32(hi, _mm512_sub_epi32(v32, sh)));
+		_mm512_storeu_si512(out + ii, _mm512_and_si512(xx, vmask));
+	}
+}
+
+#endif /* ACQK_X86 */
+
+static struct AcqKernels versions[] = {
+	{ "scalar", id_check_scalar, find_es_scalar, collect_bits_scalar,
+	  scan_id_scalar, extract24_scalar, pack32_scalar, unpack32_scalar },
+#ifdef ACQK_X86
+	{ "sse2", id_check_sse2, find_es_sse2, collect_bits_sse2,
+	  scan_id_sse2, extract24_sse2, pack32_scalar, unpack32_scalar },
+	/* the ES signature is one 128 bit vector: sse2 is as good as it gets */
+	{ "avx2", id_check_avx2, find_es_sse2, collect_bits_avx2,
+	  scan_id_avx2, extract24_avx2, pack32_scalar, unpack32_avx2 },
+	/* byte compares need avx512bw: the RESYNC scan stays avx2 */
+	{ "avx512", id_check_avx512, find_es_sse2, collect_bits_avx512,
+	  scan_id_avx2, extract24_avx512, pack32_scalar, unpack32_avx512 },
+#endif
+};
+
+#define NVERSIONS	(sizeof(versions)/sizeof(versions[0]))
+
+struct AcqKernels acqk = {
+	"scalar", id_check_scalar, find_es_scalar, collect_bits_scalar,
+	scan_id_scalar, extract24_scalar, pack32_scalar, unpack32_scalar
+};
+
+static void crc_init(void);
+
+static int supported(const char* isa)
+{
+#ifdef ACQK_X86
+	__builtin_cpu_init();
+	if (strcmp(isa, "sse2") == 0){
+		return __builtin_cpu_supports("sse2");
+	}else if (strcmp(isa, "avx2") == 0){
+		return __builtin_cpu_supports("avx2");
+	}else if (strcmp(isa, "avx512") == 0){
+		return __builtin_cpu_supports("avx512f");
+	}
+#endif
+	return strcmp(isa, "scalar") == 0;
+}
+
+__attribute__((constructor))
+static void acqk_select(void)
+{
+	const char* want = getenv("ACQ_ISA");
+	int iv;
+
+	crc_init();
+
+	/* the last supported version is the best */
+	for (iv = 0; iv < (int)NVERSIONS; ++iv){
+		if (supported(versions[iv].isa)){
+			acqk = versions[iv];
+		}
+	}
+	if (want){
+		for (iv = 0; iv < (int)NVERSIONS; ++iv){
+			if (strcmp(want, versions[iv].isa) == 0){
+				break;
+			}
+		}
+		if (iv < (int)NVERSIONS && supported(want)){
+			acqk = versions[iv];
+		}else{
+			fprintf(stderr, "acq-kernels: ACQ_ISA=%s not available, "
+					"using %s\n", want, acqk.isa);
+		}
+	}
+	if (getenv("VERBOSE") && atoi(getenv("VERBOSE"))){
+		fprintf(stderr, "acq-kernels: %s\n", acqk.isa);
+	}
+}
+
+unsigned acqkReverse32(unsigned xx)
+{
+	xx = (xx >> 1 & 0x55555555) | (xx & 0x55555555) << 1;
+	xx = (xx >> 2 & 0x33333333) | (xx & 0x33333333) << 2;
+	xx = (xx >> 4 & 0x0f0f0f0f) | (xx & 0x0f0f0f0f) << 4;
+	return __builtin_bswap32(xx);
+}
+
+/* crc32 slice by 8: tables[k][b] is the crc of byte b followed by k zeros */
+static unsigned crc_tables[8][256];
+
+static void crc_init(void)
+{
+	unsigned ib, ik;
+
+	for (ib = 0; ib < 256; ++ib){
+		unsigned crc = ib;
+		for (ik = 0; ik < 8; ++ik){
+			crc = crc & 1? crc >> 1 ^ 0xedb88320: crc >> 1;
+		}
+		crc_tables[0][ib] = crc;
+	}
+	for (ib = 0; ib < 256; ++ib){
+		for (ik = 1; ik < 8; ++ik){
+			unsigned prev = crc_tables[ik-1][ib];
+			crc_tables[ik][ib] = prev >> 8 ^ crc_tables[0][prev & 0xff];
+		}
+	}
+}
+
+unsigned acqkCrc32(unsigned crc, const void* buf, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)buf;
+
+	crc = ~crc;
+	for (; size >= 8; size -= 8, p += 8){
+		unsigned lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;		/* little endian */
+		crc = crc_tables[7][lo & 0xff] ^ crc_tables[6][lo >> 8 & 0xff] ^
+		      crc_tables[5][lo >> 16 & 0xff] ^ crc_tables[4][lo >> 24] ^
+		      crc_tables[3][hi & 0xff] ^ crc_tables[2][hi >> 8 & 0xff] ^
+		      crc_tables[1][hi >> 16 & 0xff] ^ crc_tables[0][hi >> 24];
+	}
+	while (size--){
+		crc = crc_tables[0][(crc ^ *p++) & 0xff] ^ crc >> 8;
+	}
+	return ~crc;
+}
@@ -0,0 +1,101 @@
+/* ------------------------------------------------------------------------- */
+/* acq-kernels.h - hot loops built per ISA, chosen at startup               */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Each kernel has a scalar version and, on x86, versions compiled for
+ * SSE2, AVX2 and AVX-512 with target attributes, so the Makefile needs
+ * no arch flags. The best version the cpu supports is picked before
+ * main runs.
+ *
+ * env:
+ * ACQ_ISA=scalar|sse2|avx2|avx512   force a version, eg to test it.
+ *                                   An unsupported choice falls back
+ * VERBOSE=1                         report the choice on stderr
+ */
+
+#ifndef __ACQ_KERNELS_H__
+#define __ACQ_KERNELS_H__
+
+#include <stddef.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+struct AcqKernels {
+	const char* isa;
+
+	unsigned (*id_check)(const unsigned* frame, const unsigned* idm,
+			const unsigned* mask, int nwords);
+	/** OR of (frame[i] & mask[i]) ^ idm[i]: 0 when every word matches.
+	 *  The same bits from every version */
+
+	long (*find_es)(const unsigned* data, long nframes, int frame_words,
+			unsigned magic, unsigned mask);
+	/** first frame with words 0..3 & mask == magic & mask, or nframes */
+
+	unsigned (*collect_bits)(const unsigned* data, int bit);
+	/** bit of each of 32 words, word 0 in bit 0 */
+
+	int (*scan_id)(const unsigned char* p, int len,
+			unsigned char id, unsigned char mask);
+	/** first byte with (p[i] & mask) == id, or len. RESYNC */
+
+	void (*extract24)(const unsigned* frame, const int* words, int n,
+			int* xx);
+	/** xx[i] = signed top 24 bits of frame[words[i]] */
+
+	void (*pack32)(const unsigned* in, unsigned* out, int w);
+	/** 32 values of w bits into w words, value 0 in the lsbs of out[0].
+	 *  scalar in every version, see acq-kernels.c */
+
+	void (*unpack32)(const unsigned* in, unsigned* out, int w);
+	/** inverse of pack32 */
+};
+
+extern struct AcqKernels acqk;
+
+#define acqkIdCheck(frame, idm, mask, nwords) \
+	acqk.id_check(frame, idm, mask, nwords)
+#define acqkFindES(data, nframes, frame_words, magic, mask) \
+	acqk.find_es(data, nframes, frame_words, magic, mask)
+#define acqkCollectBits(data, bit) \
+	acqk.collect_bits(data, bit)
+#define acqkScanId(p, len, id, mask) \
+	acqk.scan_id(p, len, id, mask)
+#define acqkExtract24(frame, words, n, xx) \
+	acqk.extract24(frame, words, n, xx)
+#define acqkPack32(in, out, w) \
+	acqk.pack32(in, out, w)
+#define acqkUnpack32(in, out, w) \
+	acqk.unpack32(in, out, w)
+
+unsigned acqkReverse32(unsigned xx);
+/** bit reverse, eg collect_bits for MSB first */
+
+unsigned acqkCrc32(unsigned crc, const void* buf, size_t size);
+/** as crc32() in CRC/crc32.c, slice by 8. There is no ISA instruction
+ *  for this polynomial (SSE4.2 crc32 is Castagnoli), so one version */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_KERNELS_H__ */
@@ -0,0 +1,383 @@
+/* ------------------------------------------------------------------------- */
+/* acq-layout.c - frame layout of an ACQ435/ACQ437 site definition          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acq-layout.h"
+
+static int bitslice(const char* def)
+{
+	const char* bsf = getenv("BITSLICE_FRAME");
+
+	if (strchr(def, 'l')){
+		return 'l';
+	}else if (strchr(def, 'm')){
+		return 'm';
+	}else if (bsf && strcmp(bsf, "LSB") == 0){
+		return 'l';
+	}else if (bsf && strcmp(bsf, "MSB") == 0){
+		return 'm';
+	}
+	return 0;
+}
+
+/* ACQ435_Data::cid(), including the nwords/2 split with SPAD present */
+static unsigned cid(const struct AcqLayout* lay, int ic)
+{
+	int upper = ic >= lay->nwords/2;
+	int offset = (lay->actual_banks[ic/4] - 'A') * 4;
+
+	if (upper){
+		return lay->nbanks*8 - offset - 4 + ic%4;
+	}else{
+		return offset + ic%4;
+	}
+}
+
+static int create437(struct AcqLayout* lay, int site)
+{
+	int ic;
+
+	if (site < 1 || site > 6){
+		fprintf(stderr, "ERROR: ACQ437 site %d not in 1..6\n", site);
+		return -1;
+	}
+	lay->module = 437;
+	lay->nwords = 16;
+	strcpy(lay->banks, "437");
+	for (ic = 0; ic < lay->nwords; ++ic){
+		lay->ids[ic] = site << 5 | ic;
+		lay->kind[ic] = ACQL_ID;
+	}
+	return 0;
+}
+
+int acqLayoutCreate(struct AcqLayout* lay, const char* def)
+{
+	const char* banks = strchr(def, '=');
+	int site = atoi(def);
+	int ii, ic, ib;
+	int pmod_done = 0;
+	int sample_done = 0;
+
+	memset(lay, 0, sizeof(struct AcqLayout));
+	lay->site = site;
+	lay->id_mask = getenv("NOSID")? 0x1f: 0xff;
+
+	if (banks == 0){
+		return create437(lay, site);
+	}
+	++banks;
+	if (strcmp(banks, "437") == 0){
+		return create437(lay, site);
+	}
+	if (site < 0 || site > 6 || strlen(banks) >= sizeof(lay->banks)){
+		fprintf(stderr, "ERROR: bad site definition \"%s\"\n", def);
+		return -1;
+	}
+	lay->module = 435;
+	lay->bitslice = bitslice(def);
+	if (lay->bitslice){
+		lay->id_mask = 0x1f;
+	}
+	strcpy(lay->banks, banks);
+
+	for (ii = 0; banks[ii]; ++ii){
+		switch(banks[ii]){
+		case 'A':
+		case 'B':
+		case 'C':
+		case 'D':
+			lay->nwords += 8;
+			lay->nbanks++;
+			break;
+		case 'S':
+			/* as ACQ435_Data: SPAD is 8 words plus the PMOD word */
+			lay->nwords += 8;
+			lay->spad = 1;
+		case 'P':
+			lay->nwords += 1;
+			lay->pmod = 1;
+			break;
+		case 'l':
+		case 'm':
+			break;
+		default:
+			fprintf(stderr, "ERROR invalid bank %c\n", banks[ii]);
+			return -1;
+		}
+	}
+	if (lay->nwords > ACQL_MAXWORDS){
+		fprintf(stderr, "ERROR: \"%s\" too many words\n", def);
+		return -1;
+	}
+	for (ib = 0; ib < lay->nbanks; ++ib){
+		lay->actual_banks[ib] = banks[ib];
+		lay->actual_banks[2*lay->nbanks-ib-1] = banks[ib];
+	}
+	ib = lay->nbanks * 2;
+	if (lay->pmod) lay->actual_banks[ib++] = 'P';
+	if (lay->spad) lay->actual_banks[ib++] = 'S';
+	lay->actual_banks[ib] = '\0';
+
+	for (ic = 0; ic < lay->nwords; ++ic){
+		if (ic < lay->nbanks*8){
+			lay->ids[ic] = site << 5 | cid(lay, ic);
+			lay->kind[ic] = ACQL_ID;
+		}else if (lay->pmod && !pmod_done){
+			lay->kind[ic] = ACQL_PMOD;
+			pmod_done = 1;
+		}else if (lay->spad && !sample_done){
+			lay->kind[ic] = ACQL_SAMPLE;
+			sample_done = 1;
+		}else{
+			lay->kind[ic] = ACQL_SPAD;
+		}
+	}
+	return 0;
+}
+
+int acqLayoutDef(const struct AcqLayout* lay, char* def, int maxdef)
+{
+	return snprintf(def, maxdef, "%d=%s", lay->site, lay->banks);
+}
+
+/* detection: frame period from the repeating ID bytes, then a depth first
+ * search over site definitions that tile the frame exactly */
+
+#define DETECT_MAXP	(6*ACQL_MAXWORDS)
+#define DETECT_FRAMES	1024		/* frames checked per candidate */
+
+static int detect_period(const unsigned* data, int nwords, unsigned mask)
+{
+	int ratio[DETECT_MAXP+1];
+	int best = 0;
+	int pp;
+
+	for (pp = 8; pp <= DETECT_MAXP && 4*pp <= nwords; ++pp){
+		int n = nwords - pp < 32768? nwords - pp: 32768;
+		int hits = 0;
+		int ii;
+		for (ii = 0; ii < n; ++ii){
+			hits += ((data[ii] ^ data[ii+pp]) & mask) == 0;
+		}
+		ratio[pp] = (int)(1000LL * hits / n);
+		if (ratio[pp] > best) best = ratio[pp];
+	}
+	if (best < 500){
+		return 0;
+	}
+	/* multiples of the period score the same: take the first */
+	for (pp = 8; pp <= DETECT_MAXP && 4*pp <= nwords; ++pp){
+		if (ratio[pp] >= best - 20){
+			return pp;
+		}
+	}
+	return 0;
+}
+
+static int layout_matches(const struct AcqLayout* lay,
+	const unsigned* data, int period, int nframes, int offset)
+{
+	int iframe, ic;
+
+	for (iframe = 0; iframe < nframes; ++iframe){
+		const unsigned* frame = data + iframe*period;
+		if (frame[0] == ACQL_ES_MAGIC && frame[1] == ACQL_ES_MAGIC){
+			continue;
+		}
+		for (ic = 0; ic < lay->nwords; ++ic){
+			if (lay->kind[ic] == ACQL_ID &&
+			    ((frame[offset+ic] ^ lay->ids[ic]) & lay->id_mask)){
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int detect_sites(const unsigned* data, int period, int nframes,
+	int offset, unsigned mask, struct AcqLayout* lays, int nlays, int maxlays)
+{
+	static const char* suffixes[] = { "S", "P", "" };
+	int site;
+	int bm, is;
+
+	if (offset == period){
+		return nlays;
+	}else if (nlays == maxlays){
+		return 0;
+	}
+	/* with no site ids in the data, number the sites in order */
+	site = mask == 0xff? (data[offset] & 0xff) >> 5: nlays + 1;
+	if (site > 6){
+		return 0;
+	}
+
+	/* widest first: the frame must be tiled exactly */
+	for (bm = 15; bm >= 1; --bm){
+		for (is = 0; is < 3; ++is){
+			char def[16];
+			int nc = snprintf(def, sizeof(def), "%d=", site);
+			int ib;
+			for (ib = 0; ib < 4; ++ib){
+				if (bm & (1 << ib)) def[nc++] = 'A' + ib;
+			}
+			strcpy(def+nc, suffixes[is]);
+
+			struct AcqLayout* lay = &lays[nlays];
+			if (acqLayoutCreate(lay, def) != 0 ||
+			    offset + lay->nwords > period){
+				continue;
+			}
+			lay->id_mask = mask;
+			if (layout_matches(lay, data, period, nframes, offset)){
+				int rc = detect_sites(data, period, nframes,
+					offset + lay->nwords, mask,
+					lays, nlays+1, maxlays);
+				if (rc){
+					return rc;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* bitslice: bit 7 of the first 32 words, LSB or MSB first, is a sample
+ * count that steps by one per frame. ES frames may take a count */
+static unsigned bs_d7(const unsigned* frame, int order)
+{
+	unsigned d7 = 0;
+	int iw;
+
+	for (iw = 0; iw < 32; ++iw){
+		d7 |= (frame[iw] >> 7 & 1) << (order == 'l'? iw: 31 - iw);
+	}
+	return d7;
+}
+
+static int detect_bitslice(const unsigned* data, int period, int nframes)
+{
+	static const int orders[] = { 'l', 'm' };
+	int io;
+
+	for (io = 0; io < 2; ++io){
+		unsigned prev = 0;
+		int have_prev = 0;
+		int steps = 0;
+		int breaks = 0;
+		int iframe;
+
+		for (iframe = 0; iframe < nframes; ++iframe){
+			const unsigned* frame = data + iframe*period;
+			unsigned d7;
+			if (frame[0] == ACQL_ES_MAGIC && frame[1] == ACQL_ES_MAGIC){
+				continue;
+			}
+			d7 = bs_d7(frame, orders[io]);
+			if (have_prev){
+				if (d7 - prev == 1 || d7 - prev == 2){
+					++steps;
+				}else{
+					++breaks;
+				}
+			}
+			prev = d7;
+			have_prev = 1;
+		}
+		if (steps >= 16 && breaks*16 <= steps){
+			return orders[io];
+		}
+	}
+	return 0;
+}
+
+/* the first site carries the bitslice, as ACQ435_DataBitslice */
+static void mark_bitslice(const unsigned* data, int period, int nframes,
+		struct AcqLayout* lays, int nsites)
+{
+	struct AcqLayout* lay = &lays[0];
+	int order;
+
+	if (nsites == 0 || lay->module != 435 || lay->id_mask != 0x1f){
+		return;
+	}
+	if (lay->nbanks < 4){
+		fprintf(stderr, "WARNING: AUTODETECT NOSID, bitslice not "
+			"checked: fewer than 32 ID words in site %d\n", lay->site);
+		return;
+	}
+	order = detect_bitslice(data, period, nframes);
+	if (order){
+		int nb = strlen(lay->banks);
+		lay->banks[nb] = order;
+		lay->banks[nb+1] = '\0';
+		lay->bitslice = order;
+	}
+}
+
+int acqLayoutDetect(const unsigned* data, int nwords,
+		struct AcqLayout* lays, int maxlays, int* skip_words)
+{
+	static const unsigned masks[] = { 0xff, 0x1f };
+	int im;
+
+	for (im = 0; im < 2; ++im){
+		int period = detect_period(data, nwords, masks[im]);
+		int nframes;
+		int offset;
+		int first_nsites = 0;
+		int first_offset = 0;
+
+		if (period == 0){
+			continue;
+		}
+		nframes = nwords/period - 1;
+		if (nframes > DETECT_FRAMES) nframes = DETECT_FRAMES;
+
+		/* the data may not start at a frame boundary: any rotation of
+		 * the frame tiles, prefer the one with sites in order */
+		for (offset = 0; offset < period; ++offset){
+			int nsites = detect_sites(data + offset, period, nframes,
+					0, masks[im], lays, 0, maxlays);
+			if (nsites && lays[0].site <= lays[nsites-1].site){
+				*skip_words = offset;
+				mark_bitslice(data + offset, period, nframes,
+						lays, nsites);
+				return nsites;
+			}else if (nsites && first_nsites == 0){
+				first_nsites = nsites;
+				first_offset = offset;
+			}
+		}
+		if (first_nsites){
+			*skip_words = first_offset;
+			first_nsites = detect_sites(data + first_offset, period,
+					nframes, 0, masks[im], lays, 0, maxlays);
+			mark_bitslice(data + first_offset, period, nframes,
+					lays, first_nsites);
+			return first_nsites;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* ------------------------------------------------------------------------- */
+/* acq-layout.h - frame layout of an ACQ435/ACQ437 site definition          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Computes the same word layout as ACQ435_Data / ACQ437_Data, for tools
+ * that generate or inspect frames without validating them.
+ *
+ * def : "site=BANKS" ACQ435, eg 1=ABCDS, see acq435_validator.cpp
+ *       "site=437"   ACQ437, 16 channels
+ *       "site"       ACQ437, as acq437_validator
+ */
+
+#ifndef __ACQ_LAYOUT_H__
+#define __ACQ_LAYOUT_H__
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define ACQL_MAXWORDS	66
+
+#define ACQL_ES_MAGIC	0xaa55f151
+#define ACQL_NES	4
+
+enum ACQL_KIND {
+	ACQL_ID,		/* channel data, low byte is the ID */
+	ACQL_PMOD,		/* not checked */
+	ACQL_SAMPLE,		/* SPAD[0], sample counter */
+	ACQL_SPAD		/* checked only with MONITOR_SPAD */
+};
+
+struct AcqLayout {
+	int site;
+	int module;		/* 435 or 437 */
+	char banks[16];		/* as given, eg ABCDS */
+	char actual_banks[16];	/* word order, eg ABCDDCBAPS */
+	int nbanks;
+	int nwords;
+	int spad;
+	int pmod;
+	int bitslice;		/* 'l', 'm' or 0 */
+	unsigned id_mask;
+	unsigned ids[ACQL_MAXWORDS];
+	enum ACQL_KIND kind[ACQL_MAXWORDS];
+};
+
+int acqLayoutCreate(struct AcqLayout* lay, const char* def);
+/** returns 0 on success, prints reason and returns -1 on error.
+ *  honours env NOSID, BITSLICE_FRAME like the validators */
+
+int acqLayoutDef(const struct AcqLayout* lay, char* def, int maxdef);
+/** prints the definition back, eg "1=ABCDS" */
+
+int acqLayoutDetect(const unsigned* data, int nwords,
+		struct AcqLayout* lays, int maxlays, int* skip_words);
+/** infers the site definitions from raw data, a few thousand frames.
+ *  returns the number of sites, 0 if no layout fits. skip_words is the
+ *  offset of the first whole frame. id_mask is 0x1f if the data carries
+ *  no site ids (NOSID, bitslice). A bitslice sample count in the first
+ *  site is reported as "N=ABCDl" or "N=ABCDm". ACQ437 frames have the
+ *  same ID pattern as ACQ435 banks AB, and are reported as "N=AB" */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_LAYOUT_H__ */
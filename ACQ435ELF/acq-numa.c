@@ -0,0 +1,172 @@
+/* ------------------------------------------------------------------------- */
+/* acq-numa.c - buffer placement and thread pinning                          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "acq-numa.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND	2
+#endif
+
+static int hugepages(void)
+{
+	return getenv("HUGEPAGES") && atoi(getenv("HUGEPAGES"));
+}
+
+static int numa_node(void)
+{
+	return getenv("NUMA_NODE")? atoi(getenv("NUMA_NODE")): -1;
+}
+
+static size_t mapped_length(size_t bytes)
+{
+	size_t page = hugepages()? ACQ_HUGEPAGE: sysconf(_SC_PAGESIZE);
+	return (bytes + page - 1) & ~(page - 1);
+}
+
+static void bind_node(void* buf, size_t len, int node)
+{
+	unsigned long mask[16] = {};
+
+	if (node >= (int)(sizeof(mask)*8)){
+		fprintf(stderr, "acqAlloc: NUMA_NODE %d out of range\n", node);
+		return;
+	}
+	mask[node/(sizeof(long)*8)] |= 1UL << (node%(sizeof(long)*8));
+	if (syscall(SYS_mbind, buf, len, MPOL_BIND,
+				mask, sizeof(mask)*8, 0) != 0){
+		perror("acqAlloc: mbind");
+	}
+}
+
+void* acqAlloc(size_t bytes)
+{
+	static int warned;
+	void* buf = MAP_FAILED;
+	size_t len;
+
+	if (!hugepages() && numa_node() < 0){
+		if (posix_memalign(&buf, 64, bytes) != 0){
+			perror("acqAlloc");
+			exit(1);
+		}
+		return buf;
+	}
+	len = mapped_length(bytes);
+	if (hugepages()){
+		buf = mmap(0, len, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (buf == MAP_FAILED && !warned++){
+			fprintf(stderr, "acqAlloc: no hugetlb pages, "
+					"using transparent hugepages\n");
+		}
+	}
+	if (buf == MAP_FAILED){
+		buf = mmap(0, len, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED){
+			perror("acqAlloc: mmap");
+			exit(1);
+		}
+		if (hugepages()){
+			madvise(buf, len, MADV_HUGEPAGE);
+		}
+	}
+	/* before first touch, so the pages fault in on the node */
+	if (numa_node() >= 0){
+		bind_node(buf, len, numa_node());
+	}
+	return buf;
+}
+
+void acqFree(void* buf, size_t bytes)
+{
+	if (!buf){
+		return;
+	}else if (!hugepages() && numa_node() < 0){
+		free(buf);
+	}else{
+		munmap(buf, mapped_length(bytes));
+	}
+}
+
+void acqBufferStream(FILE* fp)
+{
+	if (hugepages() || numa_node() >= 0){
+		setvbuf(fp, (char*)acqAlloc(ACQ_HUGEPAGE), _IOFBF, ACQ_HUGEPAGE);
+	}
+}
+
+/* index'th cpu in a list like "2-3,6" */
+static int nth_cpu(const char* list, int index)
+{
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0;
+	const char* cursor = list;
+
+	while (*cursor && ncpus < CPU_SETSIZE){
+		char* end;
+		int c1 = strtol(cursor, &end, 10);
+		int c2 = c1;
+		if (end == cursor){
+			break;
+		}
+		if (*end == '-'){
+			cursor = end + 1;
+			c2 = strtol(cursor, &end, 10);
+		}
+		for (; c1 <= c2 && ncpus < CPU_SETSIZE; ++c1){
+			cpus[ncpus++] = c1;
+		}
+		cursor = *end == ','? end + 1: end;
+	}
+	return ncpus? cpus[index % ncpus]: -1;
+}
+
+int acqPinThread(const char* role, int index)
+{
+	char key[32];
+	const char* list;
+	cpu_set_t cpus;
+	int cpu;
+
+	snprintf(key, sizeof(key), "CPU_%s", role);
+	list = getenv(key);
+	if (!list || (cpu = nth_cpu(list, index)) < 0){
+		return -1;
+	}
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0){
+		fprintf(stderr, "acqPinThread: %s failed to pin to cpu %d\n",
+				key, cpu);
+		return -1;
+	}
+	return cpu;
+}
@@ -0,0 +1,59 @@
+/* ------------------------------------------------------------------------- */
+/* acq-numa.h - buffer placement and thread pinning                          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * env:
+ * HUGEPAGES=1       frame and block buffers from 2MB hugepages (MAP_HUGETLB),
+ *                   falls back to transparent hugepages (MADV_HUGEPAGE)
+ * NUMA_NODE=N       bind buffers to node N, eg the node local to the NIC
+ * CPU_READER=LIST   cpus for threads in each role, LIST eg "2" or "2-3,6"
+ * CPU_VALIDATOR=LIST  single threaded tools run in this role
+ * CPU_WRITER=LIST
+ * CPU_WORKER=LIST   generator and daemon worker pools, one cpu per thread
+ */
+
+#ifndef __ACQ_NUMA_H__
+#define __ACQ_NUMA_H__
+
+#include <stdio.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define ACQ_HUGEPAGE	(2*1024*1024)
+
+void* acqAlloc(size_t bytes);
+/** 64 byte aligned buffer, placed according to HUGEPAGES, NUMA_NODE */
+
+void acqFree(void* buf, size_t bytes);
+
+void acqBufferStream(FILE* fp);
+/** with HUGEPAGES or NUMA_NODE, give fp a hugepage sized acqAlloc buffer */
+
+int acqPinThread(const char* role, int index);
+/** pin calling thread to the index'th cpu in CPU_<role>.
+ *  returns cpu, or -1 when the role is not set */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_NUMA_H__ */
@@ -0,0 +1,222 @@
+/* ------------------------------------------------------------------------- */
+/* acq-perf.c - hardware performance counters per processing stage         */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+#include "acq-perf.h"
+
+#ifdef PERF_COUNTERS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define NCOUNTERS	4
+
+static const struct {
+	unsigned type;
+	unsigned long long config;
+	const char* name;
+} counters[NCOUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,		"cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,	"instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,	"cache-misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,	"branch-misses" },
+};
+
+static const char* stage_names[ACQP_NSTAGES] = {
+	"read", "es", "id", "extras", "output"
+};
+
+/* one per thread, kept after the thread exits for the report */
+struct PerfThread {
+	int fd[NCOUNTERS];
+	struct perf_event_mmap_page* pc[NCOUNTERS];
+	unsigned long long start[ACQP_NSTAGES][NCOUNTERS];
+	unsigned long long total[ACQP_NSTAGES][NCOUNTERS];
+	unsigned long long calls[ACQP_NSTAGES];
+	struct PerfThread* next;
+};
+
+static __thread struct PerfThread* self;
+static struct PerfThread* threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long frames;
+static int failed;
+
+static int open_counter(unsigned type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static struct PerfThread* perf_thread(void)
+{
+	struct PerfThread* pt;
+	int ic;
+
+	if (self){
+		return self;
+	}
+	pt = calloc(1, sizeof(struct PerfThread));
+	for (ic = 0; ic < NCOUNTERS; ++ic){
+		pt->fd[ic] = open_counter(counters[ic].type, counters[ic].config);
+		if (pt->fd[ic] < 0){
+			if (!__sync_fetch_and_add(&failed, 1)){
+				perror("acqPerf: perf_event_open");
+			}
+			continue;
+		}
+		pt->pc[ic] = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ,
+					MAP_SHARED, pt->fd[ic], 0);
+		if (pt->pc[ic] == MAP_FAILED){
+			pt->pc[ic] = 0;
+		}
+	}
+	pthread_mutex_lock(&threads_lock);
+	pt->next = threads;
+	threads = pt;
+	pthread_mutex_unlock(&threads_lock);
+	return self = pt;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline unsigned long long rdpmc(unsigned counter)
+{
+	unsigned lo, hi;
+	__asm__ __volatile__ ("rdpmc" : "=a" (lo), "=d" (hi) : "c" (counter));
+	return (unsigned long long)hi << 32 | lo;
+}
+#endif
+
+/* user space read of a self monitoring counter, else read(2) */
+static unsigned long long read_counter(struct PerfThread* pt, int ic)
+{
+	struct perf_event_mmap_page* pc = pt->pc[ic];
+	unsigned long long count = 0;
+
+	if (pt->fd[ic] < 0){
+		return 0;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if (pc && pc->cap_user_rdpmc){
+		unsigned seq, idx;
+		do {
+			seq = pc->lock;
+			__sync_synchronize();
+			idx = pc->index;
+			count = pc->offset;
+			if (idx){
+				unsigned width = pc->pmc_width;
+				long long pmc = rdpmc(idx - 1);
+				pmc <<= 64 - width;
+				pmc >>= 64 - width;
+				count += pmc;
+			}
+			__sync_synchronize();
+		} while (pc->lock != seq);
+		if (idx){
+			return count;
+		}
+	}
+#endif
+	if (read(pt->fd[ic], &count, sizeof(count)) != sizeof(count)){
+		count = 0;
+	}
+	return count;
+}
+
+void acqPerfBegin(enum ACQ_PERF_STAGE stage)
+{
+	struct PerfThread* pt = perf_thread();
+	int ic;
+
+	for (ic = 0; ic < NCOUNTERS; ++ic){
+		pt->start[stage][ic] = read_counter(pt, ic);
+	}
+}
+
+void acqPerfEnd(enum ACQ_PERF_STAGE stage)
+{
+	struct PerfThread* pt = perf_thread();
+	int ic;
+
+	for (ic = 0; ic < NCOUNTERS; ++ic){
+		pt->total[stage][ic] += read_counter(pt, ic) - pt->start[stage][ic];
+	}
+	++pt->calls[stage];
+}
+
+void acqPerfFrames(unsigned long long nframes)
+{
+	__sync_fetch_and_add(&frames, nframes);
+}
+
+void acqPerfReport(void)
+{
+	unsigned long long total[ACQP_NSTAGES][NCOUNTERS] = {};
+	unsigned long long calls[ACQP_NSTAGES] = {};
+	double nf = frames? (double)frames: 1;
+	struct PerfThread* pt;
+	int is, ic;
+
+	pthread_mutex_lock(&threads_lock);
+	for (pt = threads; pt; pt = pt->next){
+		for (is = 0; is < ACQP_NSTAGES; ++is){
+			for (ic = 0; ic < NCOUNTERS; ++ic){
+				total[is][ic] += pt->total[is][ic];
+			}
+			calls[is] += pt->calls[is];
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	fprintf(stderr, "PERF frames:%llu%s\n", frames,
+			failed? " (counters unavailable)": "");
+	fprintf(stderr, "%-10s %12s", "stage", "calls");
+	for (ic = 0; ic < NCOUNTERS; ++ic){
+		fprintf(stderr, " %14s", counters[ic].name);
+	}
+	fprintf(stderr, " %6s\n", "ipc");
+	for (is = 0; is < ACQP_NSTAGES; ++is){
+		if (calls[is] == 0){
+			continue;
+		}
+		fprintf(stderr, "%-10s %12llu", stage_names[is], calls[is]);
+		for (ic = 0; ic < NCOUNTERS; ++ic){
+			fprintf(stderr, " %14.2f", total[is][ic]/nf);
+		}
+		fprintf(stderr, " %6.2f\n", total[is][0]?
+			(double)total[is][1]/total[is][0]: 0.0);
+	}
+}
+
+#endif /* PERF_COUNTERS */
@@ -0,0 +1,74 @@
+/* ------------------------------------------------------------------------- */
+/* acq-perf.h - hardware performance counters per processing stage         */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Built only with make PERF=1 (-DPERF_COUNTERS), otherwise every macro
+ * is empty and nothing is linked in. Counters are cycles, instructions,
+ * cache misses and branch misses, opened per thread with perf_event_open
+ * and read in user space with rdpmc where the kernel allows, so a stage
+ * costs tens of cycles to bracket. At exit the totals per stage are
+ * reported per frame to stderr.
+ *
+ * needs kernel.perf_event_paranoid <= 2 (user space counting)
+ */
+
+#ifndef __ACQ_PERF_H__
+#define __ACQ_PERF_H__
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+enum ACQ_PERF_STAGE {
+	ACQP_READ,
+	ACQP_ES,		/* ES frame detect */
+	ACQP_ID,		/* channel ID check */
+	ACQP_EXTRAS,		/* per site checks after the ID check: bitslice,
+				 * SPAD sample count, detail of failed frames */
+	ACQP_OUTPUT,		/* output formatting and write */
+	ACQP_NSTAGES
+};
+
+#ifdef PERF_COUNTERS
+
+void acqPerfBegin(enum ACQ_PERF_STAGE stage);
+void acqPerfEnd(enum ACQ_PERF_STAGE stage);
+void acqPerfFrames(unsigned long long nframes);
+void acqPerfReport(void);
+
+#define ACQ_PERF_BEGIN(stage)	acqPerfBegin(stage)
+#define ACQ_PERF_END(stage)	acqPerfEnd(stage)
+#define ACQ_PERF_FRAMES(n)	acqPerfFrames(n)
+#define ACQ_PERF_REPORT()	acqPerfReport()
+
+#else
+
+#define ACQ_PERF_BEGIN(stage)	do {} while(0)
+#define ACQ_PERF_END(stage)	do {} while(0)
+#define ACQ_PERF_FRAMES(n)	do {} while(0)
+#define ACQ_PERF_REPORT()	do {} while(0)
+
+#endif /* PERF_COUNTERS */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_PERF_H__ */
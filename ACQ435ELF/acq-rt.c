@@ -0,0 +1,250 @@
+/* ------------------------------------------------------------------------- */
+/* acq-rt.c - real time monitor: block latency and input backlog            */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "acq-rt.h"
+
+/* log linear histogram: 16 sub buckets per power of 2, ~6% resolution */
+#define SUB_BITS	4
+#define SUB		(1<<SUB_BITS)
+#define NBUCKETS	(64*SUB)
+
+struct Histogram {
+	const char* name;
+	const char* units;
+	unsigned long long count[NBUCKETS];
+	unsigned long long total;
+	unsigned long long max;
+};
+
+int acq_rt_enabled;
+int acq_rt_degraded;
+unsigned acq_rt_epoch;
+
+static struct {
+	const char* name;
+	int fd;
+	int backlog_ok;			/* fd is a pipe or socket */
+	unsigned block;
+	unsigned long long budget_ns;
+	unsigned long long backlog_max;
+	int degrade;
+
+	unsigned nframes;
+	unsigned long long t0;		/* block start */
+	unsigned long long t_read;	/* this frame read */
+	unsigned long long busy;	/* read to validated, this block */
+	unsigned long long nblocks;
+	unsigned long long over_budget;
+	unsigned long long degraded_blocks;
+	time_t last_warn;
+
+	struct Histogram latency;
+	struct Histogram wait;
+	struct Histogram backlog;
+} RT;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bucket(unsigned long long xx)
+{
+	int msb;
+
+	if (xx < SUB){
+		return xx;
+	}
+	msb = 63 - __builtin_clzll(xx);
+	return (msb - SUB_BITS + 1) * SUB + ((xx >> (msb - SUB_BITS)) & (SUB-1));
+}
+
+static unsigned long long bucketLow(int ib)
+{
+	int e = ib / SUB;
+
+	if (e == 0){
+		return ib;
+	}
+	return (unsigned long long)(SUB + ib % SUB) << (e - 1);
+}
+
+static void record(struct Histogram* h, unsigned long long xx)
+{
+	h->count[bucket(xx)]++;
+	h->total++;
+	if (xx > h->max) h->max = xx;
+}
+
+static unsigned long long percentile(const struct Histogram* h, double pc)
+{
+	unsigned long long want = (unsigned long long)(h->total * pc / 100);
+	unsigned long long sum = 0;
+	int ib;
+
+	for (ib = 0; ib < NBUCKETS; ++ib){
+		sum += h->count[ib];
+		if (sum > want){
+			return bucketLow(ib);
+		}
+	}
+	return h->max;
+}
+
+static void print(const struct Histogram* h)
+{
+	static const double pcs[] = { 50, 90, 99, 99.9, 99.99 };
+	int ib, ip;
+
+	if (h->total == 0){
+		return;
+	}
+	fprintf(stderr, "RT %s %s: n=%llu", RT.name, h->name, h->total);
+	for (ip = 0; ip < sizeof(pcs)/sizeof(double); ++ip){
+		fprintf(stderr, " p%g=%llu", pcs[ip], percentile(h, pcs[ip]));
+	}
+	fprintf(stderr, " max=%llu %s\n", h->max, h->units);
+	for (ib = 0; ib < NBUCKETS; ++ib){
+		if (h->count[ib]){
+			fprintf(stderr, "RT %s %s %12llu %12llu\n",
+				RT.name, h->name, bucketLow(ib), h->count[ib]);
+		}
+	}
+}
+
+static unsigned long long envull(const char* key, unsigned long long def)
+{
+	const char* value = getenv(key);
+	return value? strtoull(value, 0, 0): def;
+}
+
+void acqRtInit(const char* name, int fd)
+{
+	struct stat sb;
+
+	if (!getenv("REALTIME") || !atoi(getenv("REALTIME"))){
+		return;
+	}
+	RT.name = name;
+	RT.fd = fd;
+	RT.block = envull("RT_BLOCK", 1024);
+	RT.budget_ns = envull("RT_BUDGET_US", 10000) * 1000;
+	RT.degrade = envull("RT_DEGRADE", 0);
+	RT.latency.name = "latency";
+	RT.latency.units = "ns";
+	RT.wait.name = "wait";
+	RT.wait.units = "ns";
+	RT.backlog.name = "backlog";
+	RT.backlog.units = "bytes";
+	if (RT.block < 1) RT.block = 1;
+
+	if (fstat(fd, &sb) == 0 && (S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode))){
+		int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+		RT.backlog_ok = 1;
+		RT.backlog_max = envull("RT_BACKLOG",
+				pipe_size > 0? pipe_size/2: 32768);
+	}
+	acq_rt_enabled = 1;
+	atexit(acqRtReport);
+}
+
+void _acqRtRead(void)
+{
+	RT.t_read = now_ns();
+	if (RT.nframes == 0){
+		RT.t0 = RT.t_read;
+	}
+}
+
+/* latency is the sum of read to validated over the frames of a block.
+ * Time blocked waiting for input is not the validator falling behind,
+ * it is reported apart as the wait. Falling behind shows as backlog */
+void _acqRtFrame(void)
+{
+	unsigned long long t1 = now_ns();
+	int backlog = 0;
+	int over;
+
+	RT.busy += t1 - RT.t_read;
+	if (++RT.nframes < RT.block){
+		return;
+	}
+	RT.nframes = 0;
+	record(&RT.latency, RT.busy);
+	record(&RT.wait, t1 - RT.t0 - RT.busy);
+	RT.nblocks++;
+
+	if (RT.backlog_ok && ioctl(RT.fd, FIONREAD, &backlog) == 0){
+		record(&RT.backlog, backlog);
+	}
+	over = RT.busy > RT.budget_ns ||
+		(RT.backlog_ok && backlog > RT.backlog_max);
+	if (over){
+		RT.over_budget++;
+		if (t1/1000000000 != RT.last_warn){
+			RT.last_warn = t1/1000000000;
+			fprintf(stderr, "RT WARNING %s: block %llu latency %llu us "
+				"backlog %d bytes%s\n", RT.name, RT.nblocks,
+				RT.busy/1000, backlog,
+				RT.degrade && !acq_rt_degraded? ", ID checks only": "");
+		}
+		if (RT.degrade){
+			acq_rt_degraded = 1;
+		}
+	}else if (acq_rt_degraded && backlog <= RT.backlog_max/2){
+		acq_rt_degraded = 0;
+		acq_rt_epoch++;
+		if (t1/1000000000 != RT.last_warn){
+			RT.last_warn = t1/1000000000;
+			fprintf(stderr, "RT %s: block %llu caught up, full checks\n",
+					RT.name, RT.nblocks);
+		}
+	}
+	if (acq_rt_degraded){
+		RT.degraded_blocks++;
+	}
+	RT.busy = 0;
+}
+
+void acqRtReport(void)
+{
+	if (!acq_rt_enabled){
+		return;
+	}
+	fprintf(stderr, "RT %s: blocks %llu of %u frames, over budget %llu, "
+			"degraded %llu\n", RT.name, RT.nblocks, RT.block,
+			RT.over_budget, RT.degraded_blocks);
+	print(&RT.latency);
+	print(&RT.wait);
+	print(&RT.backlog);
+	acq_rt_enabled = 0;
+}
@@ -0,0 +1,70 @@
+/* ------------------------------------------------------------------------- */
+/* acq-rt.h - real time monitor: block latency and input backlog            */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * env:
+ * REALTIME=1        enable
+ * RT_BLOCK=N        frames per timed block                    [1024]
+ * RT_BUDGET_US=N    read to validated time budget per block    [10000]
+ * RT_BACKLOG=N      input backlog budget, bytes     [half the pipe size]
+ * RT_DEGRADE=1      over budget: check IDs only until the backlog clears
+ *
+ * block latency is the read to validated time summed over the frames of
+ * the block, time spent waiting for input is reported apart as the wait.
+ * histograms of latency, wait and backlog are printed to stderr at exit.
+ */
+
+#ifndef __ACQ_RT_H__
+#define __ACQ_RT_H__
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+extern int acq_rt_enabled;
+extern int acq_rt_degraded;		/* ID checks only */
+extern unsigned acq_rt_epoch;		/* ++ each time full checks resume */
+
+void acqRtInit(const char* name, int fd);
+/** reads env, monitors backlog on fd when it is a pipe or socket */
+
+void _acqRtRead(void);
+void _acqRtFrame(void);
+
+static inline void acqRtRead(void)
+/** call once per frame, when the read returns */
+{
+	if (acq_rt_enabled) _acqRtRead();
+}
+
+static inline void acqRtFrame(void)
+/** call once per frame, after validation */
+{
+	if (acq_rt_enabled) _acqRtFrame();
+}
+
+void acqRtReport(void);
+/** print histograms, called at exit */
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_RT_H__ */
@@ -0,0 +1,191 @@
+/* ------------------------------------------------------------------------- */
+/* acq-trace.c - timeline of stage activity as Chrome trace events          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "acq-trace.h"
+
+#define TRACE_EVENTS	0x40000
+
+struct TraceEvent {
+	unsigned long long ns;
+	const char* name;
+	char* arg;
+	char ph;
+};
+
+/* one per thread, kept after the thread exits until the trace is written */
+struct TraceThread {
+	struct TraceEvent* events;
+	int nevents;
+	int dropped;
+	int skipping;		/* depth of dropped B events */
+	int tid;
+	const char* name;
+	struct TraceThread* next;
+};
+
+int acq_trace_enabled;
+
+static const char* trace_file;
+static int max_events = TRACE_EVENTS;
+static unsigned long long t0;
+static __thread struct TraceThread* self;
+static struct TraceThread* threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct TraceThread* trace_thread(void)
+{
+	struct TraceThread* tt;
+
+	if (self){
+		return self;
+	}
+	tt = calloc(1, sizeof(struct TraceThread));
+	tt->events = malloc(max_events * sizeof(struct TraceEvent));
+	tt->tid = syscall(SYS_gettid);
+	pthread_mutex_lock(&threads_lock);
+	tt->next = threads;
+	threads = tt;
+	pthread_mutex_unlock(&threads_lock);
+	return self = tt;
+}
+
+void acqTraceEvent(char ph, const char* name, const char* arg)
+{
+	struct TraceThread* tt = trace_thread();
+	struct TraceEvent* ev;
+
+	/* events nest, so an E matches the last B: drop a B when the
+	 * buffer is nearly full and the E that closes it, so pairs balance */
+	if (ph == 'B' && (tt->skipping || tt->nevents >= max_events - 64)){
+		++tt->skipping;
+		++tt->dropped;
+		return;
+	}else if (ph == 'E' && tt->skipping){
+		--tt->skipping;
+		++tt->dropped;
+		return;
+	}
+	ev = &tt->events[tt->nevents++];
+	ev->ns = now_ns();
+	ev->name = name;
+	ev->arg = arg? strdup(arg): 0;
+	ev->ph = ph;
+}
+
+void acqTraceThread(const char* name)
+{
+	trace_thread()->name = name;
+}
+
+static void print_string(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+	for (; *str; ++str){
+		if (*str == '"' || *str == '\\'){
+			fputc('\\', fp);
+		}
+		if ((unsigned char)*str >= ' '){
+			fputc(*str, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static void trace_write(void)
+{
+	FILE* fp = fopen(trace_file, "w");
+	struct TraceThread* tt;
+	int pid = getpid();
+	const char* sep = "";
+	int dropped = 0;
+
+	if (fp == 0){
+		perror(trace_file);
+		return;
+	}
+	fprintf(fp, "{\"traceEvents\":[\n");
+	pthread_mutex_lock(&threads_lock);
+	for (tt = threads; tt; tt = tt->next){
+		int ie;
+		if (tt->name){
+			fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+				sep, pid, tt->tid);
+			print_string(fp, tt->name);
+			fprintf(fp, "}}");
+			sep = ",\n";
+		}
+		for (ie = 0; ie < tt->nevents; ++ie){
+			struct TraceEvent* ev = &tt->events[ie];
+			unsigned long long ns = ev->ns - t0;
+			fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\","
+				"\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+				sep, ev->name, ev->ph, ns/1000, ns%1000,
+				pid, tt->tid);
+			if (ev->arg){
+				fprintf(fp, ",\"args\":{\"file\":");
+				print_string(fp, ev->arg);
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+			sep = ",\n";
+		}
+		dropped += tt->dropped;
+	}
+	pthread_mutex_unlock(&threads_lock);
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	fclose(fp);
+	if (dropped){
+		fprintf(stderr, "TRACE: %d events dropped, TRACE_EVENTS=%d\n",
+				dropped, max_events);
+	}
+}
+
+void acqTraceInit(void)
+{
+	if ((trace_file = getenv("TRACE")) == 0){
+		return;
+	}
+	if (getenv("TRACE_EVENTS")){
+		max_events = atoi(getenv("TRACE_EVENTS"));
+	}
+	if (max_events < 128){
+		max_events = 128;
+	}
+	t0 = now_ns();
+	acq_trace_enabled = 1;
+	atexit(trace_write);
+}
@@ -0,0 +1,64 @@
+/* ------------------------------------------------------------------------- */
+/* acq-trace.h - timeline of stage activity as Chrome trace events          */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * env:
+ * TRACE=FILE         record begin/end events, written to FILE at exit as
+ *                    trace event JSON: open in ui.perfetto.dev or
+ *                    chrome://tracing
+ * TRACE_EVENTS=N     events per thread [262144], preallocated. Later
+ *                    events are dropped and counted
+ *
+ * Events are per block or per file, never per frame: with TRACE unset
+ * each macro is a test of one global.
+ */
+
+#ifndef __ACQ_TRACE_H__
+#define __ACQ_TRACE_H__
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+extern int acq_trace_enabled;
+
+void acqTraceInit(void);
+/** call once from main, before any threads start */
+
+void acqTraceEvent(char ph, const char* name, const char* arg);
+/** ph 'B' or 'E'. name must be a literal, arg (eg a file name) is copied */
+
+void acqTraceThread(const char* name);
+/** names the calling thread in the timeline */
+
+#define ACQ_TRACE_BEGIN(name) \
+	do { if (acq_trace_enabled) acqTraceEvent('B', name, 0); } while(0)
+#define ACQ_TRACE_BEGIN_ARG(name, arg) \
+	do { if (acq_trace_enabled) acqTraceEvent('B', name, arg); } while(0)
+#define ACQ_TRACE_END(name) \
+	do { if (acq_trace_enabled) acqTraceEvent('E', name, 0); } while(0)
+#define ACQ_TRACE_THREAD(name) \
+	do { if (acq_trace_enabled) acqTraceThread(name); } while(0)
+
+#if defined __cplusplus
+};
+#endif
+
+#endif /* __ACQ_TRACE_H__ */
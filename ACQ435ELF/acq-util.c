@@ -18,8 +18,13 @@
     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
 /* ------------------------------------------------------------------------- */
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "acq-util.h"
 
@@ -110,3 +115,67 @@ int strsplit(char *str, char *argv[], int maxargs, const char* delim)
 	}
 	return iarg;
 }
+
+int acqCopyRange(int fd_in, long long off_in, int fd_out, size_t len)
+/** copies in the kernel: copy_file_range() file to file, splice() to
+ *  a pipe, else pread/write. fd_out is written at its current position.
+ *  returns 0, or -1 on error or if fd_in ends before len bytes */
+{
+	loff_t off = off_in;
+	int use_splice = 0;
+	char* buf;
+	size_t buf_len;
+	int rc = 0;
+
+	while (len){
+		ssize_t nc = use_splice?
+			splice(fd_in, &off, fd_out, 0, len, SPLICE_F_MORE):
+			copy_file_range(fd_in, &off, fd_out, 0, len, 0);
+		if (nc > 0){
+			len -= nc;
+		}else if (nc == 0){
+			fprintf(stderr, "acqCopyRange: input ends at %lld, "
+				"%zu bytes short\n", (long long)off, len);
+			return -1;
+		}else if (errno == EINTR){
+			continue;
+		}else if (!use_splice &&
+			(errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+			 errno == EOPNOTSUPP || errno == EBADF)){
+			use_splice = 1;
+		}else if (use_splice && errno == EINVAL){
+			break;		/* neither end is a pipe */
+		}else{
+			perror("acqCopyRange");
+			return -1;
+		}
+	}
+	if (len == 0){
+		return 0;
+	}
+	/* per call, so the helper stays reentrant */
+	buf_len = len < 0x100000? len: 0x100000;
+	if ((buf = malloc(buf_len)) == 0){
+		perror("acqCopyRange");
+		return -1;
+	}
+	while (len){
+		ssize_t nr = pread(fd_in, buf, len < buf_len? len: buf_len, off);
+		if (nr < 0 && errno == EINTR){
+			continue;
+		}else if (nr == 0){
+			fprintf(stderr, "acqCopyRange: input ends at %lld, "
+				"%zu bytes short\n", (long long)off, len);
+			rc = -1;
+			break;
+		}else if (nr < 0 || write(fd_out, buf, nr) != nr){
+			perror("acqCopyRange");
+			rc = -1;
+			break;
+		}
+		off += nr;
+		len -= nr;
+	}
+	free(buf);
+	return rc;
+}
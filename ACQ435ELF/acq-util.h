@@ -35,6 +35,13 @@ int acqMakeChannelRange(int channels[], int maxchan, const char* definition);
 
 int strsplit(char *str, char *argv[], int maxargs, const char* delim);
 /** strsplit() splits str into args, returns #args. */
+
+#include <stddef.h>
+
+int acqCopyRange(int fd_in, long long off_in, int fd_out, size_t len);
+/** copies len bytes at off_in to fd_out without passing through user
+ *  space where the kernel can. returns 0 on success, -1 on error or
+ *  if fd_in ends first. Reentrant */
 #if defined __cplusplus
 };
 #endif
@@ -0,0 +1,443 @@
+/* ------------------------------------------------------------------------- *
+ * acq435_codec.cpp  		                     	                     *
+ * ------------------------------------------------------------------------- *
+ *   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <peter dot milne at D hyphen TACQ dot com>
+ *                         www.d-tacq.com
+ *    Author: pgm
+ *                                                                           *
+ *  This program is free software; you can redistribute it and/or modify     *
+ *  it under the terms of Version 2 of the GNU General Public License        *
+ *  as published by the Free Software Foundation;                            *
+ *                                                                           *
+ *  This program is distributed in the hope that it will be useful,          *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with this program; if not, write to the Free Software              *
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @file acq435_codec.cpp lossless compression of raw ACQ435 streams.
+ *
+ * USAGE:
+ *   acq435_codec -e NCHAN < raw > packed
+ *   acq435_codec -d < packed > raw
+ *
+ * Stream : HEADER BLOCK* END
+ * HEADER : MAGIC VERSION NCHAN BLOCK_FRAMES DESC[NCHAN]
+ *          DESC : 0x100|id for channel words where the low byte is the
+ *          constant channel ID, else 0.
+ * BLOCK  : HDR SUM PAYLOAD
+ *          HDR  : count | mode << 24
+ *          SUM  : 32 bit sum of the original words, checked on decode
+ *          BM_PACKED : width[NCHAN] (bytes, padded to LW), then for each
+ *                      channel, zigzag deltas bit-packed 32 at a time.
+ *                      ID bytes are dropped and restored from DESC.
+ *          BM_RAW    : count frames, stored verbatim (ES, ID faults).
+ *          BM_TAIL   : count bytes, trailing partial frame.
+ * END    : HDR == BM_END << 24
+ *
+ * deltas are per channel, carried across blocks. ID channels are
+ * delta coded on the 24 bit sample, others on the full 32 bit word.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "acq-kernels.h"
+
+#define ES_MAGIC 	0xaa55f151
+
+#define CODEC_MAGIC	0xac435c0d
+#define CODEC_VERSION	1
+
+#define BLOCK_FRAMES	256		/* multiple of 32 */
+#define MAXCHAN		1024
+
+#define DESC_ID		0x100
+
+enum BLOCK_MODE {
+	BM_PACKED = 0,
+	BM_RAW = 1,
+	BM_TAIL = 2,
+	BM_END = 0xff
+};
+
+int verbose;
+
+static inline unsigned zigzag(int dx)
+{
+	return (unsigned(dx) << 1) ^ unsigned(dx >> 31);
+}
+static inline int unzigzag(unsigned zz)
+{
+	return int(zz >> 1) ^ -int(zz & 1);
+}
+static inline int sext24(unsigned xx)
+{
+	return int(xx << 8) >> 8;
+}
+static inline int bitwidth(unsigned xx)
+{
+	return xx? 32 - __builtin_clz(xx): 0;
+}
+
+static unsigned sum32(const unsigned* buf, int nw)
+{
+	unsigned sum = 0;
+	for (int ii = 0; ii < nw; ++ii){
+		sum += buf[ii];
+	}
+	return sum;
+}
+
+class Codec {
+protected:
+	int nchan;
+	unsigned* desc;
+	unsigned* prev;		/* last value per channel */
+	unsigned* zz;		/* channel major deltas, BLOCK_FRAMES per chan */
+	unsigned char* widths;	/* bit width per chan, padded to 4 */
+
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+
+	static void writeOrDie(const void* buf, int size, int nmemb, FILE* fp){
+		if (fwrite(buf, size, nmemb, fp) != size_t(nmemb)){
+			perror("fwrite");
+			exit(1);
+		}
+	}
+	bool isID(int ic) const {
+		return (desc[ic]&DESC_ID) != 0;
+	}
+	void updatePrev(const unsigned* frame){
+		for (int ic = 0; ic < nchan; ++ic){
+			prev[ic] = isID(ic)? frame[ic] >> 8: frame[ic];
+		}
+	}
+	void init(int _nchan){
+		nchan = _nchan;
+		desc = new unsigned[nchan];
+		prev = new unsigned[nchan]();
+		zz = new unsigned[nchan*BLOCK_FRAMES];
+		widths = new unsigned char[(nchan+3)&~3];
+	}
+	Codec() : nchan(0), desc(0), prev(0), zz(0), widths(0),
+		bytes_in(0), bytes_out(0)
+	{}
+public:
+	virtual ~Codec() {}
+	virtual int operator() (FILE* fin, FILE* fout) = 0;
+
+	void report(const char* what) {
+		if (verbose){
+			fprintf(stderr, "%s: in %llu out %llu ratio %.2f\n",
+				what, bytes_in, bytes_out,
+				bytes_out? double(bytes_in)/bytes_out: 0.0);
+		}
+	}
+};
+
+class Encoder: public Codec {
+	unsigned* buf;
+	bool learned;
+
+	/* IDs are learned from the first frame that is not ES.
+	 * A word is an ID channel when its low byte holds for the block */
+	void learn(const unsigned* frames, int nframes){
+		int i0 = 0;
+
+		memset(desc, 0, nchan*sizeof(unsigned));
+		while (i0 < nframes && frames[i0*nchan] == ES_MAGIC){
+			++i0;
+		}
+		if (i0 == nframes){
+			return;
+		}
+		const unsigned* f0 = frames + i0*nchan;
+		for (int ic = 0; ic < nchan; ++ic){
+			desc[ic] = DESC_ID | (f0[ic]&0xff);
+		}
+		for (int isam = i0+1; isam < nframes; ++isam){
+			const unsigned* ff = frames + isam*nchan;
+			if (ff[0] == ES_MAGIC){
+				continue;
+			}
+			for (int ic = 0; ic < nchan; ++ic){
+				if ((ff[ic]&0xff) != (desc[ic]&0xff)){
+					desc[ic] = 0;
+				}
+			}
+		}
+	}
+	void writeHeader(){
+		unsigned hdr[4] = {
+			CODEC_MAGIC, CODEC_VERSION, unsigned(nchan), BLOCK_FRAMES
+		};
+		writeOrDie(hdr, sizeof(unsigned), 4, fout);
+		writeOrDie(desc, sizeof(unsigned), nchan, fout);
+		bytes_out += (4 + nchan) * sizeof(unsigned);
+	}
+	bool idsMatch(const unsigned* frame) const {
+		unsigned diff = 0;
+		for (int ic = 0; ic < nchan; ++ic){
+			if (isID(ic)){
+				diff |= (frame[ic] ^ desc[ic]) & 0xff;
+			}
+		}
+		return diff == 0;
+	}
+	void writeBlockHeader(int count, int mode, unsigned sum){
+		unsigned hdr[2] = { unsigned(count) | unsigned(mode) << 24, sum };
+		writeOrDie(hdr, sizeof(unsigned), 2, fout);
+		bytes_out += sizeof(hdr);
+	}
+	void writeRaw(const unsigned* frames, int nframes){
+		writeBlockHeader(nframes, BM_RAW, sum32(frames, nframes*nchan));
+		writeOrDie(frames, sizeof(unsigned), nframes*nchan, fout);
+		bytes_out += nframes*nchan*sizeof(unsigned);
+		updatePrev(frames + (nframes-1)*nchan);
+	}
+	void writePacked(const unsigned* frames, int nframes){
+		int ngroups = (nframes+31)/32;
+		unsigned packed[32];
+
+		memset(widths, 0, (nchan+3)&~3);
+		memset(zz, 0, nchan*BLOCK_FRAMES*sizeof(unsigned));
+
+		for (int isam = 0; isam < nframes; ++isam){
+			const unsigned* ff = frames + isam*nchan;
+			for (int ic = 0; ic < nchan; ++ic){
+				unsigned dz;
+				if (isID(ic)){
+					unsigned xx = ff[ic] >> 8;
+					dz = zigzag(sext24(xx - prev[ic]));
+					prev[ic] = xx;
+				}else{
+					dz = zigzag(int(ff[ic] - prev[ic]));
+					prev[ic] = ff[ic];
+				}
+				zz[ic*BLOCK_FRAMES+isam] = dz;
+			}
+		}
+		int nw = 0;
+		for (int ic = 0; ic < nchan; ++ic){
+			unsigned all = 0;
+			for (int isam = 0; isam < nframes; ++isam){
+				all |= zz[ic*BLOCK_FRAMES+isam];
+			}
+			widths[ic] = bitwidth(all);
+			nw += widths[ic] * ngroups;
+		}
+		writeBlockHeader(nframes, BM_PACKED, sum32(frames, nframes*nchan));
+		writeOrDie(widths, 1, (nchan+3)&~3, fout);
+		for (int ic = 0; ic < nchan; ++ic){
+			for (int ig = 0; ig < ngroups; ++ig){
+				acqkPack32(zz+ic*BLOCK_FRAMES+ig*32, packed, widths[ic]);
+				writeOrDie(packed, sizeof(unsigned), widths[ic], fout);
+			}
+		}
+		bytes_out += ((nchan+3)&~3) + nw*sizeof(unsigned);
+	}
+	/* split into runs of frames with good IDs, and runs without */
+	void encodeBlock(const unsigned* frames, int nframes){
+		int run0 = 0;
+		bool run_good = idsMatch(frames);
+
+		for (int isam = 1; isam <= nframes; ++isam){
+			bool good = isam < nframes && idsMatch(frames+isam*nchan);
+			if (isam == nframes || good != run_good){
+				if (run_good){
+					writePacked(frames+run0*nchan, isam-run0);
+				}else{
+					writeRaw(frames+run0*nchan, isam-run0);
+				}
+				run0 = isam;
+				run_good = good;
+			}
+		}
+	}
+	FILE* fout;
+public:
+	Encoder(int _nchan) : learned(false), fout(0) {
+		init(_nchan);
+		buf = new unsigned[nchan*BLOCK_FRAMES];
+	}
+	virtual int operator() (FILE* fin, FILE* _fout) {
+		fout = _fout;
+		int nbytes;
+		const int block_bytes = nchan*BLOCK_FRAMES*sizeof(unsigned);
+
+		while((nbytes = fread(buf, 1, block_bytes, fin)) > 0){
+			int nframes = nbytes/(nchan*sizeof(unsigned));
+			int tail = nbytes%(nchan*sizeof(unsigned));
+
+			bytes_in += nbytes;
+			if (!learned){
+				learn(buf, nframes);
+				writeHeader();
+				learned = true;
+			}
+			if (nframes){
+				encodeBlock(buf, nframes);
+			}
+			if (tail){
+				unsigned char* pt = (unsigned char*)(buf + nframes*nchan);
+				writeBlockHeader(tail, BM_TAIL, 0);
+				writeOrDie(pt, 1, tail, fout);
+				bytes_out += tail;
+				break;
+			}
+		}
+		if (!learned){
+			/* empty input: still a stream the decoder accepts */
+			learn(buf, 0);
+			writeHeader();
+			learned = true;
+		}
+		writeBlockHeader(0, BM_END, 0);
+		fflush(fout);
+		report("encode");
+		return 0;
+	}
+};
+
+class Decoder: public Codec {
+	unsigned* buf;
+	unsigned* packed;
+
+	void readOrDie(void* buf, int size, int nmemb, FILE* fp){
+		if (fread(buf, size, nmemb, fp) != size_t(nmemb)){
+			fprintf(stderr, "ERROR: truncated stream\n");
+			exit(1);
+		}
+		bytes_in += size*nmemb;
+	}
+	int decodePacked(FILE* fin, int nframes){
+		int ngroups = (nframes+31)/32;
+
+		readOrDie(widths, 1, (nchan+3)&~3, fin);
+		for (int ic = 0; ic < nchan; ++ic){
+			if (widths[ic] > 32){
+				fprintf(stderr, "ERROR: bad width %d chan %d\n",
+						widths[ic], ic);
+				return -1;
+			}
+			for (int ig = 0; ig < ngroups; ++ig){
+				readOrDie(packed, sizeof(unsigned), widths[ic], fin);
+				acqkUnpack32(packed, zz+ic*BLOCK_FRAMES+ig*32, widths[ic]);
+			}
+		}
+		for (int isam = 0; isam < nframes; ++isam){
+			unsigned* ff = buf + isam*nchan;
+			for (int ic = 0; ic < nchan; ++ic){
+				int dx = unzigzag(zz[ic*BLOCK_FRAMES+isam]);
+				if (isID(ic)){
+					prev[ic] = (prev[ic] + dx) & 0x00ffffff;
+					ff[ic] = prev[ic] << 8 | (desc[ic]&0xff);
+				}else{
+					prev[ic] += dx;
+					ff[ic] = prev[ic];
+				}
+			}
+		}
+		return 0;
+	}
+public:
+	Decoder() : buf(0), packed(new unsigned[32]) {}
+
+	virtual int operator() (FILE* fin, FILE* fout) {
+		unsigned hdr[4];
+
+		readOrDie(hdr, sizeof(unsigned), 4, fin);
+		if (hdr[0] != CODEC_MAGIC || hdr[1] != CODEC_VERSION){
+			fprintf(stderr, "ERROR: not an acq435_codec stream\n");
+			return 1;
+		}
+		if (hdr[2] == 0 || hdr[2] > MAXCHAN || hdr[3] != BLOCK_FRAMES){
+			fprintf(stderr, "ERROR: bad header nchan:%u block:%u\n",
+					hdr[2], hdr[3]);
+			return 1;
+		}
+		init(hdr[2]);
+		readOrDie(desc, sizeof(unsigned), nchan, fin);
+		buf = new unsigned[nchan*BLOCK_FRAMES];
+
+		for (int iblock = 0; ; ++iblock){
+			unsigned bh[2];
+			readOrDie(bh, sizeof(unsigned), 2, fin);
+			int count = bh[0] & 0x00ffffff;
+			int mode = bh[0] >> 24;
+
+			switch(mode){
+			case BM_END:
+				fflush(fout);
+				report("decode");
+				return 0;
+			case BM_TAIL:
+				/* a tail is less than one frame, by definition */
+				if (count >= nchan*int(sizeof(unsigned))){
+					fprintf(stderr, "ERROR: block %d bad tail %d\n",
+							iblock, count);
+					return 1;
+				}
+				readOrDie(buf, 1, count, fin);
+				writeOrDie(buf, 1, count, fout);
+				bytes_out += count;
+				continue;
+			case BM_RAW:
+			case BM_PACKED:
+				if (count < 1 || count > BLOCK_FRAMES){
+					fprintf(stderr, "ERROR: block %d bad count %d\n",
+							iblock, count);
+					return 1;
+				}
+				if (mode == BM_RAW){
+					readOrDie(buf, sizeof(unsigned), count*nchan, fin);
+					updatePrev(buf + (count-1)*nchan);
+				}else if (decodePacked(fin, count) != 0){
+					return 1;
+				}
+				if (sum32(buf, count*nchan) != bh[1]){
+					fprintf(stderr, "ERROR: block %d checksum\n", iblock);
+					return 1;
+				}
+				writeOrDie(buf, sizeof(unsigned), count*nchan, fout);
+				bytes_out += count*nchan*sizeof(unsigned);
+				break;
+			default:
+				fprintf(stderr, "ERROR: block %d bad mode %d\n",
+						iblock, mode);
+				return 1;
+			}
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	if (getenv("VERBOSE")){
+		verbose = atoi(getenv("VERBOSE"));
+	}
+	if (argc == 3 && strcmp(argv[1], "-e") == 0){
+		int nchan = atoi(argv[2]);
+		if (nchan < 1 || nchan > MAXCHAN){
+			fprintf(stderr, "ERROR: NCHAN %d out of range\n", nchan);
+			return 1;
+		}
+		return Encoder(nchan)(stdin, stdout);
+	}else if (argc == 2 && strcmp(argv[1], "-d") == 0){
+		return Decoder()(stdin, stdout);
+	}else{
+		fprintf(stderr, "USAGE: acq435_codec -e NCHAN < raw > packed\n"
+				"       acq435_codec -d < packed > raw\n");
+		return 1;
+	}
+}
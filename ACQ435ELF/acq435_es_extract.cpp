@@ -0,0 +1,176 @@
+/* ------------------------------------------------------------------------- *
+ * acq435_es_extract.cpp  		                     	             *
+ * ------------------------------------------------------------------------- *
+ *   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <peter dot milne at D hyphen TACQ dot com>
+ *                         www.d-tacq.com
+ *    Author: pgm
+ *                                                                           *
+ *  This program is free software; you can redistribute it and/or modify     *
+ *  it under the terms of Version 2 of the GNU General Public License        *
+ *  as published by the Free Software Foundation;                            *
+ *                                                                           *
+ *  This program is distributed in the hope that it will be useful,          *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with this program; if not, write to the Free Software              *
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @file acq435_es_extract.cpp cut a window of frames around each ES
+ *
+ * USAGE: acq435_es_extract --pre=N --post=N [--prefix=PFX|--concat=OUT] FILE
+ *
+ * NCHANNELS=N  words per frame, as acq435_es_validator [32]
+ *
+ * --pre=N      frames before the ES frame
+ * --post=N     frames after the ES frame
+ * --prefix=PFX one file per window, PFX.0000 .. [FILE.es]
+ * --concat=OUT all windows in OUT, index in OUT.idx:
+ *              window es_offset es_sample out_offset bytes
+ *
+ * ES frames come from FILE.esi when current (acq_inspect --mkindex),
+ * else one scan of the file. Windows are copied with acqCopyRange(),
+ * so the data stays in the kernel (and may be reflinked).
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "acq-esi.h"
+#include "acq-util.h"
+
+namespace UI {
+	unsigned pre = 0;
+	unsigned post = 0;
+	const char* prefix = 0;
+	const char* concat = 0;
+	const char* fname = 0;
+};
+
+int nchannels = 32;
+int verbose;
+
+void ui(int argc, char* argv[])
+{
+	for (int ii = 1; ii < argc; ++ii){
+		const char* this_arg = argv[ii];
+
+		if (sscanf(this_arg, "--pre=%u", &UI::pre) == 1 ||
+		    sscanf(this_arg, "--post=%u", &UI::post) == 1){
+			;
+		}else if (strncmp(this_arg, "--prefix=", 9) == 0){
+			UI::prefix = this_arg + 9;
+		}else if (strncmp(this_arg, "--concat=", 9) == 0){
+			UI::concat = this_arg + 9;
+		}else if (this_arg[0] == '-' || UI::fname){
+			fprintf(stderr, "ERROR: bad argument \"%s\"\n", this_arg);
+			exit(1);
+		}else{
+			UI::fname = this_arg;
+		}
+	}
+	if (!UI::fname){
+		fprintf(stderr, "USAGE: acq435_es_extract --pre=N --post=N "
+			"[--prefix=PFX|--concat=OUT] FILE\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (getenv("NCHANNELS")) nchannels = atoi(getenv("NCHANNELS"));
+	if (getenv("VERBOSE")) verbose = atoi(getenv("VERBOSE"));
+	ui(argc, argv);
+
+	const int frame_bytes = nchannels * sizeof(unsigned);
+	int fd = open(UI::fname, O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0){
+		perror(UI::fname);
+		return 1;
+	}
+
+	/* the map is only touched when there is no current sidecar */
+	AcqEsiEntry* es = 0;
+	int nes = acqEsiLoad(UI::fname, frame_bytes, sb.st_size, &es);
+	if (nes < 0){
+		void* base = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED){
+			perror("mmap");
+			return 1;
+		}
+		madvise(base, sb.st_size, MADV_SEQUENTIAL);
+		nes = acqEsiScan(base, sb.st_size, frame_bytes, &es);
+		munmap(base, sb.st_size);
+		if (nes < 0){
+			return 1;
+		}
+	}
+
+	char prefix[256];
+	snprintf(prefix, sizeof(prefix), "%s.es", UI::fname);
+	if (UI::prefix) snprintf(prefix, sizeof(prefix), "%s", UI::prefix);
+
+	int fd_out = -1;
+	FILE* idx = 0;
+	if (UI::concat){
+		char idxname[256];
+		snprintf(idxname, sizeof(idxname), "%s.idx", UI::concat);
+		fd_out = open(UI::concat, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		idx = fopen(idxname, "w");
+		if (fd_out < 0 || !idx){
+			perror(UI::concat);
+			return 1;
+		}
+	}
+
+	unsigned long long out_offset = 0;
+	const unsigned long long nframes = sb.st_size / frame_bytes;
+	for (int ies = 0; ies < nes; ++ies){
+		unsigned long long es_frame = es[ies].offset / frame_bytes;
+		unsigned long long f0 = es_frame > UI::pre? es_frame - UI::pre: 0;
+		unsigned long long f1 = es_frame + 1 + UI::post;
+		if (f1 > nframes) f1 = nframes;
+
+		size_t len = (f1 - f0) * frame_bytes;
+		if (!UI::concat){
+			char fname[300];
+			snprintf(fname, sizeof(fname), "%s.%04d", prefix, ies);
+			fd_out = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			if (fd_out < 0){
+				perror(fname);
+				return 1;
+			}
+		}
+		if (acqCopyRange(fd, f0 * frame_bytes, fd_out, len) != 0){
+			return 1;
+		}
+		if (UI::concat){
+			fprintf(idx, "%d %llu %u %llu %llu\n", ies, es[ies].offset,
+				es[ies].sample, out_offset, (unsigned long long)len);
+			out_offset += len;
+		}else{
+			close(fd_out);
+		}
+	}
+	if (UI::concat){
+		fclose(idx);
+		close(fd_out);
+	}
+	if (verbose){
+		fprintf(stderr, "acq435_es_extract: %d windows\n", nes);
+	}
+	return 0;
+}
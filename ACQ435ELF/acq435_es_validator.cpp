@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <map>
+#include <vector>
+
+#include "acq-trace.h"
 
 #define MAGIC 0xaa55f154
 
@@ -14,19 +21,76 @@
 #define MAGIC_FOURSOME(x4)	(IS_MAGIC((x4)[0]) && IS_MAGIC((x4)[1]) && IS_MAGIC((x4)[2]) && IS_MAGIC((x4)[3]))
 
 int nchannels = 32;
-int errors;
 
 int verbose;
 
-int validate(unsigned* xx, int nchannels, int sample, int *prev_sample)
+/* HISTOGRAM=1 : ES interval and embedded sample gap, merged over all files
+ * HIST_BIN=N  : bin width [1, exact]
+ */
+int histogram;
+unsigned hist_bin = 1;
+
+class Histogram {
+	std::map<unsigned, unsigned long long> bins;
+public:
+	void add(unsigned value) {
+		++bins[value/hist_bin*hist_bin];
+	}
+	void merge(const Histogram& other) {
+		std::map<unsigned, unsigned long long>::const_iterator it;
+		for (it = other.bins.begin(); it != other.bins.end(); ++it){
+			bins[it->first] += it->second;
+		}
+	}
+	unsigned long long count(unsigned bin) const {
+		std::map<unsigned, unsigned long long>::const_iterator it =
+							bins.find(bin);
+		return it == bins.end()? 0: it->second;
+	}
+	/* prints both histograms on a common set of bins */
+	static void print(const Histogram& interval, const Histogram& gap) {
+		std::map<unsigned, unsigned long long> keys(interval.bins);
+		keys.insert(gap.bins.begin(), gap.bins.end());
+
+		printf("%10s %12s %12s\n", "bin", "es_interval", "sample_gap");
+		std::map<unsigned, unsigned long long>::const_iterator it;
+		for (it = keys.begin(); it != keys.end(); ++it){
+			printf("%10u %12llu %12llu\n", it->first,
+				interval.count(it->first), gap.count(it->first));
+		}
+	}
+};
+
+/* per file results, filled in by whichever thread validates the file */
+struct FileStats {
+	const char* fname;
+	bool opened;
+	int errors;
+	int samples;
+	int es_count;
+	int prev_sample;
+	unsigned prev_es_sample;	/* sample count embedded in ES */
+	bool have_es;
+	Histogram es_interval;
+	Histogram sample_gap;
+
+	FileStats(const char* _fname = "-") :
+		fname(_fname), opened(false), errors(0), samples(0),
+		es_count(0), prev_sample(0), prev_es_sample(0), have_es(false)
+	{}
+};
+
+int validate(unsigned* xx, int nchannels, int sample, FileStats* track)
 /* -1 ES_ERR, 0 : no ES, 1: ESGOOD */
 {
+	int *prev_sample = &track->prev_sample;
+
 	if (MAGIC_FOURSOME(xx)){
 		int broke_at = 0;
 		for (int iquad = 8; iquad < nchannels; iquad += 8){
 			if (!MAGIC_FOURSOME(xx+iquad)){
 				broke_at = iquad;
-				++::errors;
+				++track->errors;
 				break;					
 			}
 		}
@@ -36,6 +100,15 @@ int validate(unsigned* xx, int nchannels, int sample, int *prev_sample)
 			xx[4], xx[5], xx[6], xx[7], broke_at,
 			broke_at? "FAIL": "PASS");
 		}
+		if (histogram){
+			if (track->have_es){
+				track->es_interval.add(sample - *prev_sample);
+				track->sample_gap.add(xx[4] - track->prev_es_sample);
+			}
+			track->prev_es_sample = xx[4];
+			track->have_es = true;
+		}
+		++track->es_count;
 		*prev_sample = sample;
 		return broke_at? -1: 1;
 	}else{
@@ -43,45 +116,115 @@ int validate(unsigned* xx, int nchannels, int sample, int *prev_sample)
 	}
 }
 
-int validate(const char* fname)
+int validate(FileStats* stats)
 {
+	const char* fname = stats->fname;
 	FILE* fp = strcmp(fname, "-") ==0 ? stdin: fopen(fname, "r");
 	if (fp == 0){ 
-		perror(fname); exit(1);
+		perror(fname);
+		return -1;
 	}
+	stats->opened = true;
 	unsigned* xx = new unsigned[nchannels];
 	int sample = 0;
-	int prev_sample = 0;
 
 	while (fread(xx, sizeof(unsigned), nchannels, fp) == nchannels){
-		if (validate(xx, nchannels, sample, &prev_sample) == 0){
+		if (validate(xx, nchannels, sample, stats) == 0){
 			/* check for second half ES */
-			validate(xx+nchannels/2, nchannels, sample, &prev_sample);
+			validate(xx+nchannels/2, nchannels, sample, stats);
 		}
 		++sample;
 	}
+	stats->samples = sample;
+	delete [] xx;
 
 	if (strcmp(fname, "-")){
 		fclose(fp);
 	}
-	if (verbose){
-		printf("%d/%d %s\n", ::errors, sample, fname);
-	}
-	return errors;
+	return stats->errors;
 }
+
+/* batch mode: THREADS workers take the next file until none are left */
+struct Batch {
+	std::vector<FileStats> files;
+	int next;
+
+	static void* _work(void* arg) {
+		Batch* batch = (Batch*)arg;
+		int ifile;
+		ACQ_TRACE_THREAD("worker");
+		while ((ifile = __sync_fetch_and_add(&batch->next, 1)) <
+						(int)batch->files.size()){
+			ACQ_TRACE_BEGIN_ARG("file", batch->files[ifile].fname);
+			validate(&batch->files[ifile]);
+			ACQ_TRACE_END("file");
+		}
+		return 0;
+	}
+	int operator() (int nthreads) {
+		std::vector<pthread_t> threads(nthreads);
+		Histogram es_interval;
+		Histogram sample_gap;
+		int failed = 0;
+		int errors = 0;
+		unsigned long long samples = 0;
+
+		next = 0;
+		for (int it = 0; it < nthreads; ++it){
+			pthread_create(&threads[it], 0, _work, this);
+		}
+		for (int it = 0; it < nthreads; ++it){
+			pthread_join(threads[it], 0);
+		}
+		/* report in argument order, regardless of completion order */
+		for (int ii = 0; ii < files.size(); ++ii){
+			const FileStats& fs = files[ii];
+			if (verbose || fs.errors || !fs.opened){
+				printf("%d/%d %s%s\n", fs.errors, fs.samples,
+					fs.fname, fs.opened? "": " OPEN FAIL");
+			}
+			if (fs.errors || !fs.opened) ++failed;
+			errors += fs.errors;
+			samples += fs.samples;
+			es_interval.merge(fs.es_interval);
+			sample_gap.merge(fs.sample_gap);
+		}
+		if (files.size() > 1){
+			printf("TOTAL files:%d failed:%d errors:%d samples:%llu\n",
+				(int)files.size(), failed, errors, samples);
+		}
+		if (histogram){
+			Histogram::print(es_interval, sample_gap);
+		}
+		return failed? 1: 0;
+	}
+};
+
 int main(int argc, char *argv[])
 {
 	if (getenv("NCHANNELS")) nchannels = atoi(getenv("NCHANNELS"));
 	if (getenv("VERBOSE")) verbose = atoi(getenv("VERBOSE"));
+	acqTraceInit();
+	if (getenv("HISTOGRAM")) histogram = atoi(getenv("HISTOGRAM"));
+	if (getenv("HIST_BIN")) hist_bin = atoi(getenv("HIST_BIN"));
+	if (hist_bin < 1) hist_bin = 1;
 
+	int nthreads = getenv("THREADS")? atoi(getenv("THREADS")):
+					sysconf(_SC_NPROCESSORS_ONLN);
+	if (verbose > 1){
+		nthreads = 1;		/* keep per ES lines in file order */
+	}
+
+	Batch batch;
 	if (argc == 1){
-		return validate("-");
+		batch.files.push_back(FileStats("-"));
 	}else{
 		for (int iarg = 1; iarg < argc; ++iarg){
-			if (validate(argv[iarg])){
-				return 1;
-			}
+			batch.files.push_back(FileStats(argv[iarg]));
 		}
 	}
-	return 0;
+	if (nthreads > (int)batch.files.size()) nthreads = batch.files.size();
+	if (nthreads < 1) nthreads = 1;
+
+	return batch(nthreads);
 }
@@ -29,8 +29,21 @@
 #include <vector>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "acq-util.h"
+#include "acq-rt.h"
+#include "acq-container.h"
+#include "acq-numa.h"
+#include "acq-frame.h"
+#include "acq-perf.h"
+#include "acq-trace.h"
+#include "acq-kernels.h"
 
 #define MAXCHAN		192
 #define MAXWORDS	66
@@ -66,6 +79,7 @@ protected:
 	char* actual_banks;
 	unsigned offset;
 	unsigned sample;
+	unsigned rt_epoch;
 
 	enum IDS {
 		IDS_NOCHECK = 0,
@@ -114,6 +128,7 @@ protected:
 				def(_def), site(_site),
 				banks(_banks),
 				nwords(0), nbanks(0),
+				rt_epoch(0),
 				ID_MASK(id_mask)
 	{
 		memset(bank_mask, 0, sizeof(bank_mask));
@@ -205,6 +220,34 @@ public:
 	void setOffset(int _offset){
 		offset = _offset;
 	}
+	bool isDataWord(int ic) const {
+		return ic < nbanks*8;
+	}
+	/* index of the SPAD sample count word, or -1 */
+	int sampleWord() const {
+		for (int ic = 0; ic < nwords; ++ic){
+			if (ids[ic] == unsigned(IDS_SAMPLE)){
+				return ic;
+			}
+		}
+		return -1;
+	}
+	virtual bool isBitslice() const {
+		return false;
+	}
+	/* channel IDs only, no state: used to find frame alignment */
+	bool idsMatch(const unsigned *data) const {
+		const unsigned *mydata = data+offset;
+		for (int ic = 0; ic < nbanks*8; ++ic){
+			if ((mydata[ic]^ids[ic])&ID_MASK){
+				return false;
+			}
+		}
+		return true;
+	}
+	unsigned firstId() const {
+		return ids[0];
+	}
 	bool isES(unsigned *data){
 		for (int ii = 0; ii < NES; ++ii){
 			if (data[ii] != ES_MAGIC ){
@@ -213,6 +256,7 @@ public:
 		}
 		printf("%16lld ES detected %08x at 0x%08x, %d\n",
 				byte_count, data[0], data[NES], data[NES]);
+		return true;
 	}
 	virtual bool isValid(unsigned *data){
 		unsigned *mydata = data+offset;
@@ -226,16 +270,26 @@ public:
 			bool this_error = false;
 
 
-			switch(ids[ic]){
+			switch(int(ids[ic])){
 			case IDS_NOCHECK:
 				break;
 			case IDS_SPAD:
+				if (acq_rt_degraded){
+					break;
+				}
 				if (mydata[ic] != spad_cache[ic]){
 					print_spad = true;
 					spad_cache[ic] = mydata[ic];
 				}
 				break;
 			case IDS_SAMPLE:
+				if (acq_rt_degraded){
+					break;
+				}else if (rt_epoch != acq_rt_epoch){
+					/* checks resumed, take the count as found */
+					rt_epoch = acq_rt_epoch;
+					sample = mydata[ic] - 1;
+				}
 				if (mydata[ic] == sample+1){
 					++sample;
 					if (sample%100000 == 0){
@@ -268,7 +322,7 @@ public:
 
 		if (print_spad){
 			for (int ic = 0; ic < nwords; ++ic){
-				switch(ids[ic]){
+				switch(int(ids[ic])){
 				case IDS_SPAD:
 				case IDS_SAMPLE:
 					printf("%08x ", mydata[ic]);
@@ -298,15 +352,7 @@ public:
 class BitCollectorLsbFirst : public BitCollector {
 public:
 	virtual unsigned collect_bits(unsigned *data, int bit){
-		unsigned xx = 0;
-		unsigned bmask = 1<<bit;
-		for (unsigned cursor = 0x1; cursor; cursor <<= 1){
-			if (*data++ & bmask){
-				xx |= cursor;
-			}
-		}
-
-		return xx;
+		return acqkCollectBits(data, bit);
 	}
 	BitCollectorLsbFirst() : BitCollector("BitCollectorLsbFirst") {}
 };
@@ -314,15 +360,7 @@ public:
 class BitCollectorMsbFirst : public BitCollector {
 public:
 	virtual unsigned collect_bits(unsigned *data, int bit){
-		unsigned xx = 0;
-		unsigned bmask = 1<<bit;
-		for (unsigned cursor = 1<<31; cursor; cursor >>= 1){
-			if (*data++ & bmask){
-				xx |= cursor;
-			}
-		}
-
-		return xx;
+		return acqkReverse32(acqkCollectBits(data, bit));
 	}
 	BitCollectorMsbFirst() : BitCollector("BitCollectorMsbFirst") {}
 };
@@ -359,6 +397,10 @@ public:
 
 		BS new_bs;
 		new_bs.d7 = bc.collect_bits(data, 7);
+		if (acq_rt_degraded){
+			sample_count = new_bs.d7;
+			return true;
+		}
 		new_bs.d6 = bc.collect_bits(data, 6);
 		new_bs.d5 = bc.collect_bits(data, 5);
 		time_t now = time(0);
@@ -404,6 +446,9 @@ public:
 
 		return allGood;
 	}
+	virtual bool isBitslice() const {
+		return true;
+	}
 	virtual void print() {
 		printf("Bitslice Frame:");
 		ACQ435_Data::print();
@@ -454,7 +499,7 @@ ACQ435_Data* ACQ435_Data::create(const char* _def){
 
 	if (bitslice != BS_NONE){
 		BitCollector *bc;
-		if (bitslice = BS_LSB_FIRST){
+		if (bitslice == BS_LSB_FIRST){
 			bc = new BitCollectorLsbFirst;
 		}else{
 			bc = new BitCollectorMsbFirst;
@@ -497,12 +542,237 @@ public:
 	}
 };
 
+/* per channel min, max, mean, RMS, peak to peak of the 24 bit samples.
+ * Frames are summed exactly in int64 over short blocks, relative to the
+ * first value in the block, and blocks are folded into a running mean
+ * and M2 (Chan et al.), so long shots lose no precision.
+ */
+class ChannelStats {
+	enum { BLOCK_FRAMES = 4096 };	/* 4096 * (2^24)^2 < 2^63 */
+
+	FILE* fp;
+	bool reset_on_es;
+	std::vector<int> words;		/* frame word index of each channel */
+	int nchan;
+	/* current block, SoA so the accumulate loop vectorizes */
+	int* xx;
+	int* ref;
+	int* bmin;
+	int* bmax;
+	long long* s1;
+	long long* s2;
+	unsigned nblock;
+	/* folded */
+	double* mean;
+	double* m2;
+	int* vmin;
+	int* vmax;
+	unsigned long long nfold;
+	unsigned long long frames;
+	unsigned long long seg_start;
+	int segment;
+
+	void fold() {
+		if (nblock == 0){
+			return;
+		}
+		for (int ic = 0; ic < nchan; ++ic){
+			double nb = nblock;
+			double mb = ref[ic] + s1[ic]/nb;
+			double m2b = s2[ic] - (double)s1[ic]*s1[ic]/nb;
+			if (nfold == 0){
+				mean[ic] = mb;
+				m2[ic] = m2b;
+				vmin[ic] = bmin[ic];
+				vmax[ic] = bmax[ic];
+			}else{
+				double delta = mb - mean[ic];
+				double n = nfold + nb;
+				mean[ic] += delta*nb/n;
+				m2[ic] += m2b + delta*delta*nfold*nb/n;
+				if (bmin[ic] < vmin[ic]) vmin[ic] = bmin[ic];
+				if (bmax[ic] > vmax[ic]) vmax[ic] = bmax[ic];
+			}
+		}
+		nfold += nblock;
+		nblock = 0;
+	}
+	void report() {
+		fold();
+		if (nfold == 0){
+			return;
+		}
+		fprintf(fp, "# segment:%d first:%llu frames:%llu\n",
+				segment, seg_start, nfold);
+		fprintf(fp, "#%4s %9s %9s %12s %12s %12s %9s\n",
+			"ch", "min", "max", "mean", "rms", "stdev", "p2p");
+		for (int ic = 0; ic < nchan; ++ic){
+			double var = m2[ic]/nfold;
+			fprintf(fp, "%5d %9d %9d %12.2f %12.2f %12.2f %9d\n",
+				words[ic]+1, vmin[ic], vmax[ic], mean[ic],
+				sqrt(var + mean[ic]*mean[ic]), sqrt(var),
+				vmax[ic] - vmin[ic]);
+		}
+		fflush(fp);
+	}
+public:
+	ChannelStats(FILE* _fp) :
+		fp(_fp), reset_on_es(false), nchan(0), nblock(0),
+		nfold(0), frames(0), seg_start(0), segment(0)
+	{}
+	void addChannel(int word) {
+		words.push_back(word);
+	}
+	void start(bool _reset_on_es) {
+		reset_on_es = _reset_on_es;
+		nchan = words.size();
+		xx = new int[nchan];
+		ref = new int[nchan];
+		bmin = new int[nchan];
+		bmax = new int[nchan];
+		s1 = new long long[nchan];
+		s2 = new long long[nchan];
+		mean = new double[nchan];
+		m2 = new double[nchan];
+		vmin = new int[nchan];
+		vmax = new int[nchan];
+	}
+	void add(const unsigned* frame) {
+		if (frame[0] == ES_MAGIC && frame[1] == ES_MAGIC &&
+		    frame[2] == ES_MAGIC && frame[3] == ES_MAGIC){
+			if (reset_on_es){
+				report();
+				nfold = 0;
+				seg_start = frames;
+				++segment;
+			}
+			return;
+		}
+		/* data in the top 24 bits, ID byte below */
+		acqkExtract24(frame, &words[0], nchan, xx);
+		if (nblock == 0){
+			for (int ic = 0; ic < nchan; ++ic){
+				ref[ic] = bmin[ic] = bmax[ic] = xx[ic];
+				s1[ic] = s2[ic] = 0;
+			}
+		}
+		for (int ic = 0; ic < nchan; ++ic){
+			long long dx = xx[ic] - ref[ic];
+			s1[ic] += dx;
+			s2[ic] += dx*dx;
+			bmin[ic] = xx[ic] < bmin[ic]? xx[ic]: bmin[ic];
+			bmax[ic] = xx[ic] > bmax[ic]? xx[ic]: bmax[ic];
+		}
+		++frames;
+		if (++nblock == BLOCK_FRAMES){
+			fold();
+		}
+	}
+	void close() {
+		report();
+		fclose(fp);
+	}
+};
+
 namespace UI {
 	ChannelMask cmask;
 	unsigned long maxsamples = 0;
 	FILE* fout = 0;
 	bool filenames_on_stdin = false;
 	int two_column = 1;
+	int container = 0;
+	unsigned sc_block = 1024;	/* max frames per --two_column=3 block */
+	unsigned chunk_records = 0;
+	char mask_def[128] = "";
+	ChannelStats* stats = 0;
+	unsigned decimate = 1;
+	char filter[16] = "boxcar";
+	int cic_stages = 3;
+	bool stats_es = false;		/* report and reset per ES segment */
+	int pipeline = 0;		/* read, validate, write threads */
+};
+
+/* --pipeline=1 : reader -> validator -> writer, one thread each.
+ * A fixed pool of aligned blocks circulates through three single
+ * producer, single consumer rings, free -> full -> valid -> free,
+ * so nothing is allocated per block and no stage takes a lock.
+ */
+#define PIPE_BLOCKS	8
+#define PIPE_BLOCK_BYTES	0x100000
+
+struct PipeBlock {
+	unsigned* data;
+	unsigned* sc;		/* bitslice sample count per frame */
+	int nframes;
+	bool last;
+};
+
+class BlockRing {
+	PipeBlock* slots[PIPE_BLOCKS];	/* holds the whole pool: never full */
+	unsigned head;			/* written by the producer only */
+	unsigned tail;			/* written by the consumer only */
+	/* the consumer sleeps here once it has spun for a while */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	static void unlock(void* mutex) {
+		pthread_mutex_unlock((pthread_mutex_t*)mutex);
+	}
+public:
+	BlockRing() : head(0), tail(0)
+	{
+		pthread_mutex_init(&mutex, 0);
+		pthread_cond_init(&cond, 0);
+	}
+	/* empty the ring, no thread may be using it */
+	void reset() {
+		head = tail = 0;
+	}
+	/* one lock per block, a block is up to PIPE_BLOCK_BYTES */
+	void push(PipeBlock* block) {
+		unsigned hh = head;
+		slots[hh % PIPE_BLOCKS] = block;
+		pthread_mutex_lock(&mutex);
+		__atomic_store_n(&head, hh+1, __ATOMIC_RELEASE);
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	PipeBlock* pop() {
+		unsigned tt = tail;
+		if (__atomic_load_n(&head, __ATOMIC_ACQUIRE) == tt){
+			return 0;
+		}
+		PipeBlock* block = slots[tt % PIPE_BLOCKS];
+		__atomic_store_n(&tail, tt+1, __ATOMIC_RELEASE);
+		return block;
+	}
+	/* raise stop first: a waiter sees it and returns */
+	void wake() {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	/* 0 if stop is raised first. Spins briefly, then sleeps until
+	 * push() or wake(), so an idle input costs no cpu */
+	PipeBlock* wait(const int* stop) {
+		PipeBlock* block;
+		for (int spins = 0; spins < 100; ++spins){
+			if ((block = pop()) != 0){
+				return block;
+			}
+			if (stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE)){
+				return 0;
+			}
+		}
+		pthread_mutex_lock(&mutex);
+		pthread_cleanup_push(unlock, &mutex);
+		while ((block = pop()) == 0 &&
+				!(stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE))){
+			pthread_cond_wait(&cond, &mutex);
+		}
+		pthread_cleanup_pop(1);
+		return block;
+	}
 };
 
 class FileProcessor {
@@ -510,17 +780,64 @@ class FileProcessor {
 	unsigned* buf;
 	unsigned long sample_count;
 	std::vector<ACQ435_Data*> sites;
+	char site_defs[256];
+	ACQCF_Writer* cfw;
+	unsigned long out_count;	/* frames passed to actOnValidData */
+
+	struct Pipe {
+		PipeBlock blocks[PIPE_BLOCKS];
+		BlockRing free_ring;
+		BlockRing full_ring;
+		BlockRing valid_ring;
+		int block_frames;
+		int stop;
+		int reader_done;
+		FILE* fin;
+		FILE* fout;
+		char* carry;
+	} *pipe;
 protected:
 	int sample_size;
 	int buffer_count;
 
 protected:
-	virtual int actOnValidData(unsigned buf[], FILE* fout){
-		fwrite(buf, sizeof(unsigned), sample_size, fout);
+	virtual int actOnValidData(unsigned buf[], FILE* fout, unsigned sc){
+		return writeOut(buf, sample_size, fout, sc);
+	}
+	virtual enum ACQCF_COLS ncols() {
+		return ACQCF_RAW;
+	}
+	/* all output goes here: raw stream, or records in a container */
+	int writeOut(const unsigned* rec, int nw, FILE* fout, unsigned sc){
+		if (!UI::container){
+			return fwrite(rec, sizeof(unsigned), nw, fout) == nw? 0: -1;
+		}
+		if (!cfw){
+			ACQCF_Header hdr = {};
+			hdr.ncols = ncols();
+			hdr.record_words = nw;
+			switch(hdr.ncols){
+			case ACQCF_TWO_COLUMN:
+				hdr.nchan = nw/2; break;
+			case ACQCF_SHARED_SC:
+				hdr.nchan = nw-1; break;
+			default:
+				hdr.nchan = nw;
+			}
+			hdr.chunk_records = UI::chunk_records;
+			snprintf(hdr.sites, sizeof(hdr.sites), "%s", site_defs);
+			snprintf(hdr.mask, sizeof(hdr.mask), "%s", UI::mask_def);
+			if ((cfw = acqcfOpenWriter(fout, &hdr)) == 0){
+				exit(1);
+			}
+		}
+		return acqcfWrite(cfw, rec, out_count, sc);
 	}
 public:
 	FileProcessor():
-		buf(0), sample_count(0), sample_size(0), buffer_count(0) {
+		buf(0), sample_count(0), cfw(0), out_count(0), pipe(0),
+		sample_size(0), buffer_count(0) {
+		site_defs[0] = '\0';
 	}
 
 	void addModule(const char* def) {
@@ -530,6 +847,10 @@ public:
 			module->print();
 			sample_size += module->getNwords();
 			sites.push_back(module);
+			if (strlen(site_defs) + strlen(def) + 2 < sizeof(site_defs)){
+				if (site_defs[0]) strcat(site_defs, " ");
+				strcat(site_defs, def);
+			}
 		}else{
 			fprintf(stderr, "ERROR: failed to create site \"%s\"\n",
 						def);
@@ -537,24 +858,122 @@ public:
 		}
 	}
 
-	virtual int operator() (FILE* fin, FILE* fout) {
+	enum { SC_BITSLICE = -1, SC_FRAMES = -2 };
+	/* where the per frame sample count comes from: a bitslice site,
+	 * else the frame index of the first SPAD sample word, else the
+	 * count of valid frames */
+	int sampleCountWord() {
+		int word = 0;
+		int spad = SC_FRAMES;
+		for (int si = 0; si < sites.size(); ++si){
+			ACQ435_Data* module = sites.at(si);
+			if (module->isBitslice()){
+				return SC_BITSLICE;
+			}
+			if (spad == SC_FRAMES && module->sampleWord() >= 0){
+				spad = word + module->sampleWord();
+			}
+			word += module->getNwords();
+		}
+		return spad;
+	}
 
-		if (!buf) buf = new unsigned[sample_size];
-		unsigned samples_file = 0;
+	/* frame index of the data words of all sites, subject to --mask */
+	std::vector<int> dataWords() {
+		std::vector<int> words;
+		int word = 0;
+		for (int si = 0; si < sites.size(); ++si){
+			ACQ435_Data* module = sites.at(si);
+			for (int ic = 0; ic < module->getNwords(); ++ic, ++word){
+				if (module->isDataWord(ic) && UI::cmask(word+1)){
+					words.push_back(word);
+				}
+			}
+		}
+		return words;
+	}
+	void startStats(ChannelStats* stats) {
+		std::vector<int> words = dataWords();
+		for (int ic = 0; ic < words.size(); ++ic){
+			stats->addChannel(words[ic]);
+		}
+		stats->start(UI::stats_es);
+	}
 
-		while(fread(buf, sizeof(unsigned), sample_size, fin) == sample_size){
+	static int idsMatchAll(const unsigned* frame, void* ctx) {
+		FileProcessor* fp = (FileProcessor*)ctx;
+		for (int si = 0; si < fp->sites.size(); ++si){
+			if (!fp->sites[si]->idsMatch(frame)){
+				return 0;
+			}
+		}
+		return 1;
+	}
+	/* RESYNC=1: re-lock frame alignment on the channel IDs, the bad frame
+	 * is dropped and sample count checks restart from the counts found.
+	 * returns false if the data ended first */
+	bool resync(AcqFrameReader* fr) {
+		ACQ435_Data* site0 = sites.at(0);
+
+		++acq_rt_epoch;
+		if (idsMatchAll(buf, this)){
+			byte_count += sample_size * sizeof(unsigned);
+			return true;
+		}
+		long long skipped = acqfrResync(fr, idsMatchAll, this,
+				site0->firstId(), site0->ID_MASK);
+		if (skipped < 0){
+			printf("RESYNC at %lld: no lock before end of data\n",
+					byte_count);
+			return false;
+		}
+		printf("RESYNC at %lld: skipped %lld bytes\n", byte_count, skipped);
+		byte_count += skipped;
+		return true;
+	}
+	int processFrames(AcqFrameReader* fr, FILE* fout) {
+		unsigned samples_file = 0;
+		bool resync_enabled = acqfrResyncEnabled();
+
+		for (;;){
+			bool error = false;
+			ACQ_PERF_BEGIN(ACQP_READ);
+			buf = (unsigned*)acqfrNext(fr);
+			ACQ_PERF_END(ACQP_READ);
+			if (buf == 0){
+				break;
+			}
+			acqRtRead();
+			/* perf: ES and bitslice checks are part of isValid() */
+			ACQ_PERF_BEGIN(ACQP_ID);
 			for (int si = 0; si < sites.size(); ++si){
 				ACQ435_Data* module = sites.at(si);
 				if (!module->isValid(buf)){
 					printf("ERROR at %lld site:%d offset:%d samples\n",
 					byte_count, si, samples_file);
-					return -1;
+					error = true;
+					break;
+				}
+			}
+			ACQ_PERF_END(ACQP_ID);
+			if (error){
+				if (resync_enabled && resync(fr)){
+					continue;
 				}
+				return -1;
 			}
 
-			if (fout) actOnValidData(buf, fout);
+			if (UI::stats) UI::stats->add(buf);
+			if (fout){
+				ACQ_PERF_BEGIN(ACQP_OUTPUT);
+				actOnValidData(buf, fout,
+					ACQ435_DataBitslice::sample_count);
+				ACQ_PERF_END(ACQP_OUTPUT);
+				++out_count;
+			}
 
 			byte_count += sample_size * sizeof(unsigned);
+			acqRtFrame();
 			++sample_count;
 			++samples_file;
 			if (UI::maxsamples && sample_count > UI::maxsamples){
@@ -564,17 +983,298 @@ public:
 		return 0;
 	}
 
+	/* raw pass through of a regular file: validate in place from a map
+	 * and forward validated extents with acqCopyRange(), so the data is
+	 * not copied through stdio. returns 2 if fin can not be mapped */
+	enum { EXTENT_MAX = 64*0x100000 };
+
+	int flushExtent(int fd_in, off_t start, off_t end, FILE* fout) {
+		if (end == start){
+			return 0;
+		}
+		fflush(fout);
+		return acqCopyRange(fd_in, start, fileno(fout), end - start);
+	}
+	int processMapped(FILE* fin, FILE* fout) {
+		const int frame_bytes = sample_size*sizeof(unsigned);
+		int fd = fileno(fin);
+		struct stat sb;
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+
+		if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || pos < 0 ||
+		    sb.st_size - pos < frame_bytes){
+			return 2;
+		}
+		const char* base = (const char*)mmap(0, sb.st_size, PROT_READ,
+						MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED){
+			return 2;
+		}
+		madvise((void*)base, sb.st_size, MADV_SEQUENTIAL);
+
+		unsigned samples_file = 0;
+		off_t extent = pos;
+		int rc = 0;
+
+		for (; pos + frame_bytes <= sb.st_size; pos += frame_bytes){
+			unsigned* frame = (unsigned*)(base + pos);
+			acqRtRead();
+			for (int si = 0; si < sites.size(); ++si){
+				if (!sites[si]->isValid(frame)){
+					printf("ERROR at %lld site:%d offset:%d samples\n",
+					byte_count, si, samples_file);
+					rc = -1;
+					break;
+				}
+			}
+			if (rc){
+				break;
+			}
+			if (UI::stats) UI::stats->add(frame);
+
+			byte_count += frame_bytes;
+			acqRtFrame();
+			++sample_count;
+			++samples_file;
+			if (UI::maxsamples && sample_count > UI::maxsamples){
+				pos += frame_bytes;
+				rc = 1;
+				break;
+			}
+			if (pos + frame_bytes - extent >= EXTENT_MAX){
+				if (flushExtent(fd, extent, pos + frame_bytes, fout)){
+					rc = -1;
+					break;
+				}
+				extent = pos + frame_bytes;
+			}
+		}
+		/* frames before an error are still forwarded */
+		if (flushExtent(fd, extent, pos, fout) != 0){
+			rc = -1;
+		}
+		munmap((void*)base, sb.st_size);
+		lseek(fd, pos, SEEK_SET);
+		return rc;
+	}
+	/* pipeline reader: whole frames into free blocks, a partial frame
+	 * is carried to the next block */
+	static void* _readStage(void* arg) {
+		((FileProcessor*)arg)->readStage();
+		return 0;
+	}
+	void readStage() {
+		const int frame_bytes = sample_size*sizeof(unsigned);
+		const int cap = pipe->block_frames*frame_bytes;
+		int fd = fileno(pipe->fin);
+		int carry = 0;
+		bool eof = false;
+		PipeBlock* block;
+
+		acqPinThread("READER", 0);
+		ACQ_TRACE_THREAD("reader");
+		for (;;){
+			ACQ_TRACE_BEGIN("wait");
+			block = eof? 0: pipe->free_ring.wait(&pipe->stop);
+			ACQ_TRACE_END("wait");
+			if (block == 0){
+				break;
+			}
+			char* dst = (char*)block->data;
+			int fill = carry;
+
+			ACQ_TRACE_BEGIN("read");
+
+			memcpy(dst, pipe->carry, carry);
+			while (fill < frame_bytes || (fill < cap && fill == carry)){
+				ACQ_PERF_BEGIN(ACQP_READ);
+				int nr = read(fd, dst + fill, cap - fill);
+				ACQ_PERF_END(ACQP_READ);
+				if (nr < 0 && errno == EINTR){
+					continue;
+				}else if (nr <= 0){
+					eof = true;
+					break;
+				}
+				fill += nr;
+			}
+			block->nframes = fill / frame_bytes;
+			block->last = eof;
+			carry = fill % frame_bytes;
+			memcpy(pipe->carry, dst + block->nframes*frame_bytes, carry);
+			ACQ_TRACE_END("read");
+			pipe->full_ring.push(block);
+		}
+		__atomic_store_n(&pipe->reader_done, 1, __ATOMIC_RELEASE);
+	}
+	/* pipeline writer: output formatting, then recycle the block */
+	static void* _writeStage(void* arg) {
+		((FileProcessor*)arg)->writeStage();
+		return 0;
+	}
+	void writeStage() {
+		bool last = false;
+
+		acqPinThread("WRITER", 0);
+		ACQ_TRACE_THREAD("writer");
+		while (!last){
+			ACQ_TRACE_BEGIN("wait");
+			PipeBlock* block = pipe->valid_ring.wait(0);
+			ACQ_TRACE_END("wait");
+			ACQ_TRACE_BEGIN("write");
+			ACQ_PERF_BEGIN(ACQP_OUTPUT);
+			for (int ii = 0; ii < block->nframes; ++ii){
+				actOnValidData(block->data + ii*sample_size,
+						pipe->fout, block->sc[ii]);
+				++out_count;
+			}
+			ACQ_PERF_END(ACQP_OUTPUT);
+			ACQ_TRACE_END("write");
+			last = block->last;
+			pipe->free_ring.push(block);
+		}
+	}
+	void pipeInit() {
+		const int frame_bytes = sample_size*sizeof(unsigned);
+
+		pipe = new Pipe;
+		pipe->block_frames = PIPE_BLOCK_BYTES/frame_bytes;
+		if (pipe->block_frames < 1) pipe->block_frames = 1;
+		for (int ib = 0; ib < PIPE_BLOCKS; ++ib){
+			PipeBlock& block = pipe->blocks[ib];
+			block.data = (unsigned*)acqAlloc(
+					pipe->block_frames*frame_bytes);
+			block.sc = (unsigned*)acqAlloc(
+					pipe->block_frames*sizeof(unsigned));
+		}
+		pipe->carry = new char[frame_bytes];
+	}
+	/* validation runs on the calling thread, as processFrames() */
+	int processPipeline(FILE* fin, FILE* fout) {
+		if (!pipe) pipeInit();
+
+		pipe->free_ring.reset();
+		pipe->full_ring.reset();
+		pipe->valid_ring.reset();
+		for (int ib = 0; ib < PIPE_BLOCKS; ++ib){
+			pipe->free_ring.push(&pipe->blocks[ib]);
+		}
+		pipe->stop = 0;
+		pipe->reader_done = 0;
+		pipe->fin = fin;
+		pipe->fout = fout;
+
+		pthread_t reader, writer;
+		pthread_create(&reader, 0, _readStage, this);
+		if (fout) pthread_create(&writer, 0, _writeStage, this);
+
+		unsigned samples_file = 0;
+		int rc = 0;
+		bool last = false;
+
+		while (!last){
+			ACQ_TRACE_BEGIN("wait");
+			PipeBlock* block = pipe->full_ring.wait(0);
+			ACQ_TRACE_END("wait");
+			int nvalid = 0;
+
+			ACQ_TRACE_BEGIN("validate");
+			ACQ_PERF_BEGIN(ACQP_ID);
+			for (; nvalid < block->nframes && rc == 0; ++nvalid){
+				unsigned* frame = block->data + nvalid*sample_size;
+				acqRtRead();
+				for (int si = 0; si < sites.size(); ++si){
+					if (!sites[si]->isValid(frame)){
+						printf("ERROR at %lld site:%d offset:%d samples\n",
+						byte_count, si, samples_file);
+						rc = -1;
+						break;
+					}
+				}
+				if (rc){
+					break;
+				}
+				if (UI::stats) UI::stats->add(frame);
+				block->sc[nvalid] = ACQ435_DataBitslice::sample_count;
+
+				byte_count += sample_size * sizeof(unsigned);
+				acqRtFrame();
+				++sample_count;
+				++samples_file;
+				if (UI::maxsamples && sample_count > UI::maxsamples){
+					rc = 1;
+				}
+			}
+			ACQ_PERF_END(ACQP_ID);
+			ACQ_TRACE_END("validate");
+			block->nframes = nvalid;
+			last = block->last || rc != 0;
+			block->last = last;
+			if (fout){
+				pipe->valid_ring.push(block);
+			}else{
+				pipe->free_ring.push(block);
+			}
+		}
+		if (rc != 0){
+			/* the reader may be blocked on input we no longer want */
+			__atomic_store_n(&pipe->stop, 1, __ATOMIC_RELEASE);
+			pipe->free_ring.wake();
+			if (!__atomic_load_n(&pipe->reader_done, __ATOMIC_ACQUIRE)){
+				pthread_cancel(reader);
+			}
+		}
+		if (fout) pthread_join(writer, 0);
+		pthread_join(reader, 0);
+		return rc;
+	}
+
+	/* only the base class writes frames unchanged */
+	virtual bool rawOutput() {
+		return true;
+	}
+
+	virtual int operator() (FILE* fin, FILE* fout) {
+		if (fout && rawOutput() && !UI::container && !acqfrResyncEnabled()){
+			int rc = processMapped(fin, fout);
+			if (rc != 2){
+				return rc;
+			}
+		}
+		if (UI::pipeline && !acqfrResyncEnabled()){
+			return processPipeline(fin, fout);
+		}
+		AcqFrameReader* fr = acqfrCreate(fin, sample_size*sizeof(unsigned));
+		int rc = processFrames(fr, fout);
+		acqfrDelete(fr);
+		return rc;
+	}
+
+	virtual void close() {
+		ACQ_PERF_FRAMES(sample_count);
+		ACQ_PERF_REPORT();
+		if (UI::stats){
+			UI::stats->close();
+		}
+		if (cfw){
+			acqcfClose(cfw);
+			cfw = 0;
+		}
+	}
+
 	static FileProcessor& instance();
 };
 
 
 class FileProcessorTwoColumn: public FileProcessor {
 	unsigned* lbuf;
+	virtual bool rawOutput() {
+		return false;
+	}
 protected:
-	virtual int actOnValidData(unsigned buf[], FILE* fout){
-		unsigned sc = ACQ435_DataBitslice::sample_count;
+	virtual int actOnValidData(unsigned buf[], FILE* fout, unsigned sc){
 
-		if (lbuf == 0) lbuf = new unsigned[sample_size*2];
+		if (lbuf == 0) lbuf = (unsigned*)acqAlloc(sample_size*2*sizeof(unsigned));
 
 		unsigned* cursor = lbuf;
 
@@ -584,23 +1284,250 @@ protected:
 				*cursor++ = buf[iw];
 			}
 		}
-		fwrite(lbuf, sizeof(unsigned), cursor-lbuf, fout);
+		return writeOut(lbuf, cursor-lbuf, fout, sc);
+	}
+	virtual enum ACQCF_COLS ncols() {
+		return ACQCF_TWO_COLUMN;
 	}
 public:
 	FileProcessorTwoColumn() : lbuf(0)
 	{}
 };
 
+/* one sample count per frame: sc, ch1, ch2 ... chN
+ * block mode: sc0, nframes, then nframes of ch1 .. chN, for as long
+ * as sample counts are contiguous.
+ * sc: bitslice count, else SPAD sample count, else valid frame count */
+class FileProcessorSharedSampleCount: public FileProcessor {
+	unsigned* lbuf;
+	unsigned* cursor;
+	unsigned nframes;
+	unsigned sc0;
+	unsigned block_max;
+	FILE* bfout;
+	int sc_word;
+	unsigned frames;
+	virtual bool rawOutput() {
+		return false;
+	}
+protected:
+	virtual int actOnValidData(unsigned buf[], FILE* fout, unsigned sc){
+
+		if (lbuf == 0){
+			lbuf = (unsigned*)acqAlloc(
+				(2 + sample_size*block_max)*sizeof(unsigned));
+			sc_word = sampleCountWord();
+		}
+		/* the bitslice count is 0 when there is no bitslice site */
+		if (sc_word >= 0){
+			sc = buf[sc_word];
+		}else if (sc_word == SC_FRAMES){
+			sc = frames;
+		}
+		++frames;
+
+		if (nframes && (sc != sc0 + nframes || nframes == block_max)){
+			if (flush() != 0){
+				return -1;
+			}
+		}
+		if (nframes == 0){
+			cursor = lbuf;
+			*cursor++ = sc0 = sc;
+			if (block_max > 1) *cursor++ = 0;	/* nframes */
+			bfout = fout;
+		}
+		for (int iw = 0; iw != sample_size; ++iw){
+			if (UI::cmask(iw+1)){
+				*cursor++ = buf[iw];
+			}
+		}
+		++nframes;
+		return block_max > 1? 0: flush();
+	}
+	virtual enum ACQCF_COLS ncols() {
+		return ACQCF_SHARED_SC;
+	}
+	int flush() {
+		if (nframes == 0){
+			return 0;
+		}
+		if (block_max > 1) lbuf[1] = nframes;
+		nframes = 0;
+		return writeOut(lbuf, cursor-lbuf, bfout, sc0);
+	}
+public:
+	FileProcessorSharedSampleCount(unsigned _block_max) :
+		lbuf(0), cursor(0), nframes(0), sc0(0),
+		block_max(_block_max), bfout(0), sc_word(SC_BITSLICE),
+		frames(0)
+	{
+		if (block_max > 1 && UI::container){
+			fprintf(stderr, "WARNING: container records are frames, "
+					"sample count blocks disabled\n");
+			block_max = 1;
+		}
+	}
+	virtual void close() {
+		flush();
+		FileProcessor::close();
+	}
+};
+
+
+/* decimating filter on the selected data words: one output frame
+ * sc, ch1 .. chN per --decimate=N input frames, in the input word format,
+ * filtered 24 bit value above the ID byte of the last input.
+ * boxcar : mean of N samples
+ * cic    : K stage CIC, integrators at the input rate, combs at the
+ *          output rate, scaled by the gain N^K. State is SoA int64, so
+ *          the per channel loops vectorize.
+ */
+class FileProcessorDecimate: public FileProcessor {
+	std::vector<int> words;
+	int nchan;
+	unsigned nsum;
+	unsigned sc0;
+	int stages;		/* 0: boxcar */
+	long long** integ;	/* [stages][nchan] */
+	long long** comb;	/* [stages][nchan] previous integrator outputs */
+	long long gain;
+	int* xx;
+	unsigned* lbuf;
+
+	void init() {
+		words = dataWords();
+		nchan = words.size();
+		xx = new int[nchan];
+		lbuf = new unsigned[1 + nchan];
+		integ = new long long*[stages? stages: 1];
+		comb = new long long*[stages? stages: 1];
+		for (int is = 0; is < (stages? stages: 1); ++is){
+			integ[is] = new long long[nchan];
+			comb[is] = new long long[nchan];
+			memset(integ[is], 0, nchan*sizeof(long long));
+			memset(comb[is], 0, nchan*sizeof(long long));
+		}
+	}
+	static int round_div(long long num, long long den) {
+		return num >= 0? (num + den/2)/den: -((-num + den/2)/den);
+	}
+	virtual bool rawOutput() {
+		return false;
+	}
+protected:
+	virtual int actOnValidData(unsigned buf[], FILE* fout, unsigned sc){
+		if (buf[0] == ES_MAGIC && buf[1] == ES_MAGIC){
+			return 0;
+		}
+		if (xx == 0) init();
+
+		acqkExtract24(buf, &words[0], nchan, xx);
+		if (nsum == 0){
+			sc0 = sc;
+		}
+		if (stages == 0){
+			long long* acc = integ[0];
+			for (int ic = 0; ic < nchan; ++ic){
+				acc[ic] += xx[ic];
+			}
+		}else{
+			/* integrators wrap modulo 2^64, the combs undo it */
+			unsigned long long* acc = (unsigned long long*)integ[0];
+			for (int ic = 0; ic < nchan; ++ic){
+				acc[ic] += xx[ic];
+			}
+			for (int is = 1; is < stages; ++is){
+				unsigned long long* in = (unsigned long long*)integ[is-1];
+				unsigned long long* out = (unsigned long long*)integ[is];
+				for (int ic = 0; ic < nchan; ++ic){
+					out[ic] += in[ic];
+				}
+			}
+		}
+		if (++nsum < UI::decimate){
+			return 0;
+		}
+		nsum = 0;
+
+		unsigned* cursor = lbuf;
+		*cursor++ = sc0;
+		if (stages == 0){
+			long long* acc = integ[0];
+			for (int ic = 0; ic < nchan; ++ic){
+				int yy = round_div(acc[ic], UI::decimate);
+				*cursor++ = (unsigned)yy << 8 | (buf[words[ic]] & 0xff);
+				acc[ic] = 0;
+			}
+		}else{
+			for (int ic = 0; ic < nchan; ++ic){
+				unsigned long long yy = integ[stages-1][ic];
+				for (int is = 0; is < stages; ++is){
+					unsigned long long prev = comb[is][ic];
+					comb[is][ic] = yy;
+					yy -= prev;
+				}
+				*cursor++ = (unsigned)round_div((long long)yy, gain) << 8 |
+						(buf[words[ic]] & 0xff);
+			}
+		}
+		return writeOut(lbuf, cursor-lbuf, fout, sc0);
+	}
+	virtual enum ACQCF_COLS ncols() {
+		return ACQCF_SHARED_SC;
+	}
+public:
+	FileProcessorDecimate() :
+		nchan(0), nsum(0), sc0(0), stages(0), integ(0), comb(0),
+		gain(1), xx(0), lbuf(0)
+	{
+		if (strcmp(UI::filter, "cic") == 0){
+			stages = UI::cic_stages;
+			int bits = 24;
+			for (int is = 0; is < stages; ++is){
+				gain *= UI::decimate;
+				for (unsigned dd = UI::decimate-1; dd; dd >>= 1){
+					++bits;
+				}
+			}
+			if (stages < 1 || bits > 63){
+				fprintf(stderr, "ERROR: cic %d stages x %u too big "
+					"for 64 bit state\n", stages, UI::decimate);
+				exit(1);
+			}
+		}else if (strcmp(UI::filter, "boxcar") != 0){
+			fprintf(stderr, "ERROR: --filter=%s not supported\n",
+					UI::filter);
+			exit(1);
+		}
+	}
+};
 
 FileProcessor& FileProcessor::instance()
 {
 	static FileProcessor* _instance;
 
+	if (!_instance && UI::decimate > 1){
+		_instance = new FileProcessorDecimate;
+	}
 	if (!_instance){
-		if (UI::two_column){
-			_instance = new FileProcessorTwoColumn;
-		}else{
+		switch(UI::two_column){
+		case 0:
 			_instance = new FileProcessor;
+			break;
+		case 1:
+			_instance = new FileProcessorTwoColumn;
+			break;
+		case 2:
+			_instance = new FileProcessorSharedSampleCount(1);
+			break;
+		case 3:
+			_instance = new FileProcessorSharedSampleCount(UI::sc_block);
+			break;
+		default:
+			fprintf(stderr, "ERROR: --two_column=%d not supported\n",
+					UI::two_column);
+			exit(1);
 		}
 	}
 	return *_instance;
@@ -612,15 +1539,39 @@ void ui(int argc, char* argv[])
 		char fname[128];
 		char mask_def[128];
 		printf("this arg:%s\n", this_arg);
-		if (sscanf(this_arg, "--outfile=%s", fname) == 1){
+		if (sscanf(this_arg, "--outfile=%127s", fname) == 1){
 			UI::fout = fopen(fname, "w");
 			if (!UI::fout){
 				perror(fname);
 			}
 		}else if (sscanf(this_arg, "--two_column=%d", &UI::two_column) == 1){
 			;
-		}else if (sscanf(this_arg, "--mask=%s", mask_def) == 1){
+		}else if (sscanf(this_arg, "--container=%d", &UI::container) == 1){
+			;
+		}else if (sscanf(this_arg, "--chunk=%u", &UI::chunk_records) == 1){
+			;
+		}else if (sscanf(this_arg, "--sc_block=%u", &UI::sc_block) == 1){
+			if (UI::sc_block < 1) UI::sc_block = 1;
+		}else if (sscanf(this_arg, "--mask=%127s", mask_def) == 1){
 			UI::cmask.makeMask(mask_def);
+			snprintf(UI::mask_def, sizeof(UI::mask_def), "%s", mask_def);
+		}else if (sscanf(this_arg, "--stats=%127s", fname) == 1){
+			FILE* fp = strcmp(fname, "-") == 0? stderr: fopen(fname, "w");
+			if (!fp){
+				perror(fname);
+				exit(1);
+			}
+			UI::stats = new ChannelStats(fp);
+		}else if (sscanf(this_arg, "--decimate=%u", &UI::decimate) == 1){
+			;
+		}else if (sscanf(this_arg, "--filter=%15s", UI::filter) == 1){
+			;
+		}else if (sscanf(this_arg, "--cic_stages=%d", &UI::cic_stages) == 1){
+			;
+		}else if (sscanf(this_arg, "--pipeline=%d", &UI::pipeline) == 1){
+			;
+		}else if (strcmp(this_arg, "--stats_es") == 0){
+			UI::stats_es = true;
 		}else if (sscanf(this_arg, "--maxsamples=%lu", &UI::maxsamples) == 1){
 			;
 		}else if (strcmp(this_arg, "--filenames") == 0){
@@ -650,7 +1601,9 @@ void process_filenames_stdin(FileProcessor& fp)
 		if (verbose){
 			fprintf(stderr, "process file %s\n", fname);
 		}
+		ACQ_TRACE_BEGIN_ARG("file", fname);
 		int rc = fp(fpin, UI::fout);
+		ACQ_TRACE_END("file");
 		if (rc > 0){
 			fprintf(stderr, "JOB COMPLETE\n");
 			return;
@@ -682,12 +1635,24 @@ int main(int argc, char* argv[])
 		verbose = atoi(getenv("VERBOSE"));
 	}
 
+	acqTraceInit();
+	ACQ_TRACE_THREAD("validator");
 	ui(argc, argv);
+	if (UI::stats){
+		FileProcessor::instance().startStats(UI::stats);
+	}
+	acqPinThread("VALIDATOR", 0);
+	if (!UI::filenames_on_stdin){
+		acqRtInit("acq435_tschan", 0);
+	}
 
 	if (UI::filenames_on_stdin){
 		process_filenames_stdin(FileProcessor::instance());
 	}else{
+		ACQ_TRACE_BEGIN_ARG("file", "stdin");
 		FileProcessor::instance()(stdin, UI::fout);
+		ACQ_TRACE_END("file");
 	}
+	FileProcessor::instance().close();
 }
 
@@ -25,9 +25,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include <vector>
 #include <time.h>
+
+#include "acq-rt.h"
+#include "acq-numa.h"
+#include "acq-frame.h"
+#include "acq-layout.h"
+#include "acq-perf.h"
+#include "acq-kernels.h"
 #define MAXWORDS	66
 
 #define ES_MAGIC 	0xaa55f151
@@ -39,6 +47,7 @@
  * S    : scratchpad SPAD : up to 8 LW of status
  * P    : PMOD
  * lm   : bitslice LSB, MSB
+ * 437  : ACQ437 site, 16 channels, may be mixed with ACQ435 sites
  */
 
 bool verbose;
@@ -61,6 +70,7 @@ protected:
 	char* actual_banks;
 	unsigned offset;
 	unsigned sample;
+	unsigned rt_epoch;
 
 	enum IDS {
 		IDS_NOCHECK = 0,
@@ -108,7 +118,9 @@ protected:
 			const char* _banks, unsigned id_mask) :
 				def(_def), site(_site),
 				banks(_banks),
-				nwords(0), nbanks(0),
+				spad_enabled(false), pmod_present(false),
+				nwords(0), spad_cache(0), nbanks(0),
+				rt_epoch(0),
 				ID_MASK(id_mask)
 	{
 		memset(bank_mask, 0, sizeof(bank_mask));
@@ -200,6 +212,19 @@ public:
 	void setOffset(int _offset){
 		offset = _offset;
 	}
+	/* channel IDs only, no state: used to find frame alignment */
+	bool idsMatch(const unsigned *data) const {
+		const unsigned *mydata = data+offset;
+		for (int ic = 0; ic < nbanks*8; ++ic){
+			if ((mydata[ic]^ids[ic])&ID_MASK){
+				return false;
+			}
+		}
+		return true;
+	}
+	unsigned firstId() const {
+		return ids[0];
+	}
 	bool isES(unsigned *data){
 		for (int ii = 0; ii < NES; ++ii){
 			if (data[ii] != ES_MAGIC ){
@@ -208,29 +233,91 @@ public:
 		}
 		printf("%16lld ES detected %08x at 0x%08x, %d\n",
 				byte_count, data[0], data[NES], data[NES]);
+		return true;
+	}
+	/* checkpoint: running state only, the layout comes from the defs.
+	 * stale: checks had not resumed, the count is taken as found */
+	virtual void saveState(FILE* fp) const {
+		fprintf(fp, "sample %u %d", sample, rt_epoch != acq_rt_epoch);
+		if (spad_cache){
+			fprintf(fp, " spad %d", nwords);
+			for (int ic = 0; ic < nwords; ++ic){
+				fprintf(fp, " %x", spad_cache[ic]);
+			}
+		}
+		fprintf(fp, "\n");
+	}
+	virtual int loadState(FILE* fp) {
+		int stale;
+		int nw;
+		if (fscanf(fp, " sample %u %d", &sample, &stale) != 2){
+			return -1;
+		}
+		rt_epoch = stale? acq_rt_epoch-1: acq_rt_epoch;
+		if (spad_cache){
+			if (fscanf(fp, " spad %d", &nw) != 1 || nw != nwords){
+				return -1;
+			}
+			for (int ic = 0; ic < nwords; ++ic){
+				if (fscanf(fp, " %x", &spad_cache[ic]) != 1){
+					return -1;
+				}
+			}
+		}
+		return 0;
+	}
+	/* ID words and expected values for the fused frame check */
+	void idTable(unsigned* idm, unsigned* mask) const {
+		for (int ic = 0; ic < nwords; ++ic){
+			bool id_word = ic < nbanks*8;
+			mask[ic] = id_word? ID_MASK: 0;
+			idm[ic] = id_word? ids[ic]&ID_MASK: 0;
+		}
+	}
+	/* anything to check beyond the channel IDs */
+	virtual bool hasExtras() const {
+		return spad_enabled;
 	}
 	virtual bool isValid(unsigned *data){
+		if (isES(data)){
+			return true;
+		}
+		return checkWords(data, 0);
+	}
+	/* IDs already checked: the words that follow them */
+	virtual bool extrasValid(unsigned *data){
+		return checkWords(data, nbanks*8);
+	}
+protected:
+	bool checkWords(unsigned *data, int ic0){
 		unsigned *mydata = data+offset;
 		int errors = 0;
 		bool print_spad = false;
 
-		if (isES(data)){
-			return true;
-		}
-		for (int ic = 0; ic < nwords; ++ic){
+		for (int ic = ic0; ic < nwords; ++ic){
 			bool this_error = false;
 
 
-			switch(ids[ic]){
+			switch(int(ids[ic])){
 			case IDS_NOCHECK:
 				break;
 			case IDS_SPAD:
+				if (acq_rt_degraded){
+					break;
+				}
 				if (mydata[ic] != spad_cache[ic]){
 					print_spad = true;
 					spad_cache[ic] = mydata[ic];
 				}
 				break;
 			case IDS_SAMPLE:
+				if (acq_rt_degraded){
+					break;
+				}else if (rt_epoch != acq_rt_epoch){
+					/* checks resumed, take the count as found */
+					rt_epoch = acq_rt_epoch;
+					sample = mydata[ic] - 1;
+				}
 				if (mydata[ic] == sample+1){
 					++sample;
 					if (sample%100000 == 0){
@@ -263,7 +350,7 @@ public:
 
 		if (print_spad){
 			for (int ic = 0; ic < nwords; ++ic){
-				switch(ids[ic]){
+				switch(int(ids[ic])){
 				case IDS_SPAD:
 				case IDS_SAMPLE:
 					printf("%08x ", mydata[ic]);
@@ -277,6 +364,7 @@ public:
 
 		return errors == 0;
 	}
+public:
 	unsigned ID_MASK;
 
 	static bool line_to_go;
@@ -315,15 +403,7 @@ public:
 class BitCollectorLsbFirst : public BitCollector {
 public:
 	virtual unsigned collect_bits(unsigned *data, int bit){
-		unsigned xx = 0;
-		unsigned bmask = 1<<bit;
-		for (unsigned cursor = 0x1; cursor; cursor <<= 1){
-			if (*data++ & bmask){
-				xx |= cursor;
-			}
-		}
-
-		return xx;
+		return acqkCollectBits(data, bit);
 	}
 	BitCollectorLsbFirst() : BitCollector("BitCollectorLsbFirst") {}
 };
@@ -331,15 +411,7 @@ public:
 class BitCollectorMsbFirst : public BitCollector {
 public:
 	virtual unsigned collect_bits(unsigned *data, int bit){
-		unsigned xx = 0;
-		unsigned bmask = 1<<bit;
-		for (unsigned cursor = 1<<31; cursor; cursor >>= 1){
-			if (*data++ & bmask){
-				xx |= cursor;
-			}
-		}
-
-		return xx;
+		return acqkReverse32(acqkCollectBits(data, bit));
 	}
 	BitCollectorMsbFirst() : BitCollector("BitCollectorMsbFirst") {}
 };
@@ -352,6 +424,7 @@ class ACQ435_DataBitslice : public ACQ435_Data {
 	} bs;
 	BitCollector& bc;
 	bool first_sample;
+	unsigned bs_epoch;
 
 public:
 	bool always_valid;
@@ -361,15 +434,52 @@ public:
 				ACQ435_Data(_def, _site, _banks, 0x1f),
 				bc(_bc),
 				always_valid(_always_valid),
-				first_sample(true)
+				first_sample(true),
+				bs_epoch(0)
 	{}
+	virtual bool hasExtras() const {
+		return true;
+	}
+	virtual void saveState(FILE* fp) const {
+		ACQ435_Data::saveState(fp);
+		fprintf(fp, "bs %x %x %x %d %d\n", bs.d7, bs.d6, bs.d5,
+				first_sample, bs_epoch != acq_rt_epoch);
+	}
+	virtual int loadState(FILE* fp) {
+		int first;
+		int stale;
+		if (ACQ435_Data::loadState(fp) != 0 ||
+		    fscanf(fp, " bs %x %x %x %d %d", &bs.d7, &bs.d6, &bs.d5,
+						&first, &stale) != 5){
+			return -1;
+		}
+		first_sample = first;
+		bs_epoch = stale? acq_rt_epoch-1: acq_rt_epoch;
+		return 0;
+	}
 	virtual bool isValid(unsigned *data){
-		bool allGood = true;
 		if (isES(data)){
 			return true;
 		}else if (!ACQ435_Data::isValid(data)){
 			return false;
 		}
+		return bitsValid(data);
+	}
+	virtual bool extrasValid(unsigned *data){
+		if (!ACQ435_Data::extrasValid(data)){
+			return false;
+		}
+		return bitsValid(data);
+	}
+	bool bitsValid(unsigned *data){
+		bool allGood = true;
+
+		if (acq_rt_degraded){
+			return true;
+		}else if (bs_epoch != acq_rt_epoch){
+			bs_epoch = acq_rt_epoch;
+			first_sample = true;
+		}
 
 		BS new_bs;
 		new_bs.d7 = bc.collect_bits(data, 7);
@@ -412,6 +522,26 @@ public:
 	}
 };
 
+/* ACQ437 in an ACQ435 frame: 16 ID words, ids[ic] = sid | ic */
+class ACQ437_Data : public ACQ435_Data {
+public:
+	ACQ437_Data(const char* _def, int _site, unsigned id_mask) :
+		ACQ435_Data(_def, _site, "AB", id_mask)
+	{
+		banks = "437";
+		for (int ic = 0; ic < nwords; ++ic){
+			ids[ic] = site << 5 | ic;
+		}
+	}
+	virtual void print() {
+		printf("ACQ437_Data site:%d\n", site);
+		printf("nwords:%d\n", nwords);
+		for (int ii = 0; ii < nwords; ++ii){
+			printf("%02x%c", ids[ii], ii%16==15? '\n': ' ');
+		}
+		printf("\n");
+	}
+};
 
 enum BITSLICE {
 	BS_NONE,
@@ -453,10 +583,15 @@ ACQ435_Data* ACQ435_Data::create(const char* _def){
 
 	if (!(_site >= 0 && _site <= 6)) RETERR;
 
+	if (strcmp(bank_def, "437") == 0){
+		if (bitslice != BS_NONE) RETERR;
+		return new ACQ437_Data(_def, _site, getenv("NOSID")? 0x1f: 0xff);
+	}
+
 
 	if (bitslice != BS_NONE){
 		BitCollector *bc;
-		if (bitslice = BS_LSB_FIRST){
+		if (bitslice == BS_LSB_FIRST){
 			bc = new BitCollectorLsbFirst;
 		}else{
 			bc = new BitCollectorMsbFirst;
@@ -472,25 +607,283 @@ ACQ435_Data* ACQ435_Data::create(const char* _def){
 		return new ACQ435_Data(_def, _site, bank_def, getenv("NOSID")? 0x1f: 0xff);
 	}
 	parse_err:
-	fprintf(stderr, "ERROR: line:%d USAGE: site=[ABCD][S]", rc);
+	fprintf(stderr, "ERROR: line:%d USAGE: site=[ABCD][S]|437", rc);
 	return 0;
 }
 
 
 
+/* all site IDs in a composite frame as one masked compare, so a good
+ * frame costs one pass whatever the mix of ACQ435 and ACQ437 sites */
+class FusedIds {
+	unsigned* idm;
+	unsigned* mask;
+	int nwords;
+public:
+	FusedIds(std::vector<ACQ435_Data*>& sites) : nwords(0) {
+		for (int si = 0; si < sites.size(); ++si){
+			nwords += sites[si]->getNwords();
+		}
+		idm = new unsigned[nwords];
+		mask = new unsigned[nwords];
+		for (int si = 0, iw = 0; si < sites.size(); ++si){
+			sites[si]->idTable(idm+iw, mask+iw);
+			iw += sites[si]->getNwords();
+		}
+	}
+	bool isValid(const unsigned* frame) const {
+		return acqkIdCheck(frame, idm, mask, nwords) == 0;
+	}
+};
+
+static int idsMatchAll(const unsigned* frame, void* ctx)
+{
+	std::vector<ACQ435_Data*>& sites = *(std::vector<ACQ435_Data*>*)ctx;
+	for (int si = 0; si < sites.size(); ++si){
+		if (!sites[si]->idsMatch(frame)){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* RESYNC=1: after an error, re-lock frame alignment on the channel IDs.
+ * Either way the sample count checks restart from the counts found.
+ */
+void resyncFrames(AcqFrameReader* fr, std::vector<ACQ435_Data*>& sites,
+		const unsigned* bad, int frame_bytes)
+{
+	ACQ435_Data* site0 = sites.at(0);
+
+	++acq_rt_epoch;
+	if (idsMatchAll(bad, &sites)){
+		/* still aligned, a sequence error */
+		byte_count += frame_bytes;
+		return;
+	}
+	long long skipped = acqfrResync(fr, idsMatchAll, &sites,
+			site0->firstId(), site0->ID_MASK);
+	if (skipped < 0){
+		printf("RESYNC at %lld: no lock before end of data\n",
+				byte_count);
+		return;
+	}
+	printf("RESYNC at %lld: skipped %lld bytes\n", byte_count, skipped);
+	byte_count += skipped;
+}
+
+/* --follow=FILE       validate FILE while it is written, see acqfrFollow()
+ * CHECKPOINT=FILE     save the validation state every CHECKPOINT_BYTES
+ * --resume=FILE       seek stdin to the saved offset and carry on
+ * The file is replaced atomically, so an interrupt leaves the last one.
+ */
+#define CHECKPOINT_MAGIC	"ACQ435_CHECKPOINT 1"
+#define CHECKPOINT_BYTES	0x40000000LL
+
+int saveCheckpoint(const char* fname, std::vector<const char*>& defs,
+		std::vector<ACQ435_Data*>& sites)
+{
+	char tmp[256];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	FILE* fp = fopen(tmp, "w");
+	if (fp == 0){
+		perror(tmp);
+		return -1;
+	}
+	fprintf(fp, "%s\n", CHECKPOINT_MAGIC);
+	fprintf(fp, "nosid %d\n", getenv("NOSID") != 0);
+	fprintf(fp, "defs %d", (int)defs.size());
+	for (int ii = 0; ii < defs.size(); ++ii){
+		fprintf(fp, " %s", defs[ii]);
+	}
+	fprintf(fp, "\nbyte_count %llu\n", byte_count);
+	for (int si = 0; si < sites.size(); ++si){
+		fprintf(fp, "site %d ", si);
+		sites[si]->saveState(fp);
+	}
+	fflush(fp);
+	fsync(fileno(fp));
+	if (fclose(fp) != 0 || rename(tmp, fname) != 0){
+		perror(fname);
+		return -1;
+	}
+	return 0;
+}
+
+/* header only: the sites are created from the saved defs before
+ * loadSiteStates() reads the rest */
+FILE* loadCheckpoint(const char* fname, std::vector<const char*>& defs,
+		unsigned long long* offset)
+{
+	char line[256];
+	int nosid;
+	int ndefs;
+	FILE* fp = fopen(fname, "r");
+
+	if (fp == 0){
+		perror(fname);
+		return 0;
+	}
+	if (fgets(line, sizeof(line), fp) == 0 ||
+	    strncmp(line, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) != 0 ||
+	    fscanf(fp, " nosid %d defs %d", &nosid, &ndefs) != 2){
+		goto bad;
+	}
+	for (int ii = 0; ii < ndefs; ++ii){
+		char* def;
+		if (fscanf(fp, " %ms", &def) != 1){
+			goto bad;
+		}
+		defs.push_back(def);
+	}
+	if (fscanf(fp, " byte_count %llu", offset) != 1){
+		goto bad;
+	}
+	if (nosid){
+		setenv("NOSID", "1", 0);
+	}
+	return fp;
+bad:
+	fprintf(stderr, "ERROR: %s is not a checkpoint\n", fname);
+	fclose(fp);
+	return 0;
+}
+
+int loadSiteStates(FILE* fp, std::vector<ACQ435_Data*>& sites)
+{
+	for (int si = 0; si < sites.size(); ++si){
+		int isite;
+		if (fscanf(fp, " site %d", &isite) != 1 || isite != si ||
+		    sites[si]->loadState(fp) != 0){
+			fprintf(stderr, "ERROR: checkpoint state site %d\n", si);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#define AUTODETECT_BYTES	0x100000
+
+/* site definitions from the first AUTODETECT_BYTES of the stream,
+ * which stay in the reader to be validated */
+std::vector<const char*> autodetect(AcqFrameReader* fr)
+{
+	std::vector<const char*> defs;
+	struct AcqLayout lays[6];
+	int got;
+	int skip;
+	const unsigned* data = acqfrPeek(fr, AUTODETECT_BYTES, &got);
+	int nsites = acqLayoutDetect(data, got/sizeof(unsigned), lays, 6, &skip);
+
+	if (nsites == 0){
+		fprintf(stderr, "ERROR: AUTODETECT no layout found "
+				"in %d bytes\n", got);
+		exit(1);
+	}
+	printf("AUTODETECT:");
+	for (int si = 0; si < nsites; ++si){
+		char def[32];
+		acqLayoutDef(&lays[si], def, sizeof(def));
+		defs.push_back(strdup(def));
+		printf(" %s", def);
+	}
+	if (lays[0].id_mask == 0x1f){
+		printf(" NOSID");
+		setenv("NOSID", "1", 0);
+	}
+	printf(" skip:%d bytes\n", skip*(int)sizeof(unsigned));
+
+	acqfrSkip(fr, skip*sizeof(unsigned));
+	byte_count += skip*sizeof(unsigned);
+	++acq_rt_epoch;		/* joined mid stream: take counts as found */
+	return defs;
+}
+
+static unsigned* nextFrame(AcqFrameReader* fr)
+{
+	ACQ_PERF_BEGIN(ACQP_READ);
+	unsigned* buf = (unsigned*)acqfrNext(fr);
+	ACQ_PERF_END(ACQP_READ);
+	return buf;
+}
+
 int main(int argc, char* argv[])
 {
 	if (getenv("VERBOSE")){
 		verbose = atoi(getenv("VERBOSE"));
 	}
-	std::vector<ACQ435_Data*> sites;
+	const char* checkpoint = getenv("CHECKPOINT");
+	long long checkpoint_bytes = getenv("CHECKPOINT_BYTES")?
+		atoll(getenv("CHECKPOINT_BYTES")): CHECKPOINT_BYTES;
+	const char* resume = 0;
+	const char* follow = 0;
+	std::vector<const char*> defs;
+
 	for (int ii = 1; ii < argc; ++ii){
-		ACQ435_Data* site = ACQ435_Data::create(argv[ii]);
+		if (strncmp(argv[ii], "--resume=", 9) == 0){
+			resume = argv[ii] + 9;
+		}else if (strncmp(argv[ii], "--follow=", 9) == 0){
+			follow = argv[ii] + 9;
+		}else{
+			defs.push_back(argv[ii]);
+		}
+	}
+
+	FILE* fin = stdin;
+	if (follow && (fin = fopen(follow, "r")) == 0){
+		perror(follow);
+		return 1;
+	}
+	AcqFrameReader* fr = acqfrCreate(fin, sizeof(unsigned));
+	FILE* resume_fp = 0;
+
+	if (follow){
+		printf("FOLLOW %s %s\n", follow,
+			acqfrFollow(fr, follow)? "inotify": "poll");
+	}
+
+	if (resume){
+		std::vector<const char*> saved;
+		unsigned long long offset;
+
+		if ((resume_fp = loadCheckpoint(resume, saved, &offset)) == 0){
+			return 1;
+		}
+		if (!defs.empty() && !(defs.size() == 1 &&
+					strcmp(defs[0], "auto") == 0)){
+			for (int ii = 0; ii < defs.size(); ++ii){
+				if (defs.size() != saved.size() ||
+				    strcmp(defs[ii], saved[ii]) != 0){
+					fprintf(stderr, "ERROR: site defs differ "
+						"from checkpoint %s\n", resume);
+					return 1;
+				}
+			}
+		}
+		defs = saved;
+		if (lseek(fileno(fin), offset, SEEK_SET) != (off_t)offset){
+			perror("resume needs a seekable input: lseek");
+			return 1;
+		}
+		byte_count = offset;
+		printf("RESUME at %llu from %s\n", offset, resume);
+		if (!checkpoint){
+			checkpoint = resume;
+		}
+	}else if ((defs.size() == 1 && strcmp(defs[0], "auto") == 0) ||
+		  (defs.empty() && getenv("AUTODETECT"))){
+		/* site definitions "auto", or none with AUTODETECT=1 */
+		defs = autodetect(fr);
+	}
+
+	std::vector<ACQ435_Data*> sites;
+	for (int ii = 0; ii < defs.size(); ++ii){
+		ACQ435_Data* site = ACQ435_Data::create(defs[ii]);
 		if (site){
 			sites.push_back(site);
 		}else{
 			fprintf(stderr, "ERROR: failed to create site \"%s\"\n",
-					argv[ii]);
+					defs[ii]);
 			return -1;
 		}
 	}
@@ -504,20 +897,77 @@ int main(int argc, char* argv[])
 	}
 	//ACQ435_Data::create(argv[ii])->print();
 
-	unsigned* buf = new unsigned[sample_size];
+	if (resume_fp){
+		if (loadSiteStates(resume_fp, sites) != 0){
+			return 1;
+		}
+		fclose(resume_fp);
+	}
+	unsigned long long next_checkpoint = byte_count + checkpoint_bytes;
+
+	FusedIds fused(sites);
+	acqfrSetFrameBytes(fr, sample_size*sizeof(unsigned));
+	bool resync = acqfrResyncEnabled();
+	unsigned* buf;
+	unsigned long long nframes = 0;
 
+	acqPinThread("VALIDATOR", 0);
+	acqRtInit("acq435_validator", fileno(fin));
 
-	while(fread(buf, sizeof(unsigned), sample_size, stdin) == sample_size){
+	while((buf = nextFrame(fr)) != 0){
+		bool error = false;
+		acqRtRead();
 		ACQ435_Data::print_start();
+		++nframes;
+		ACQ_PERF_BEGIN(ACQP_ES);
+		bool es = buf[0] == ES_MAGIC && sites[0]->isES(buf);
+		ACQ_PERF_END(ACQP_ES);
+		if (es){
+			/* one ES line per site, as each site reported it */
+			for (int si = 1; si < sites.size(); ++si){
+				sites[si]->isES(buf);
+			}
+			byte_count += sample_size * sizeof(unsigned);
+			ACQ435_Data::print_tidy();
+			acqRtFrame();
+			continue;
+		}
+		/* IDs good: only the sites with more to check are visited,
+		 * else each site checks in full to report the detail */
+		ACQ_PERF_BEGIN(ACQP_ID);
+		bool ids_ok = !verbose && fused.isValid(buf);
+		ACQ_PERF_END(ACQP_ID);
+		ACQ_PERF_BEGIN(ACQP_EXTRAS);
 		for (int si = 0; si < sites.size(); ++si){
-			ACQ435_Data* module = sites.at(si);
-			if (!module->isValid(buf)){
+			ACQ435_Data* module = sites[si];
+			if (ids_ok && !module->hasExtras()){
+				continue;
+			}
+			if (!(ids_ok? module->extrasValid(buf): module->isValid(buf))){
 				printf("ERROR at %lld site:%d\n",
 				byte_count, si);
+				error = true;
 			}
 		}
-		byte_count += sample_size * sizeof(unsigned);
+		ACQ_PERF_END(ACQP_EXTRAS);
+		if (error && resync){
+			resyncFrames(fr, sites, buf,
+					sample_size*sizeof(unsigned));
+		}else{
+			byte_count += sample_size * sizeof(unsigned);
+		}
 		ACQ435_Data::print_tidy();
+		acqRtFrame();
+		if (checkpoint && byte_count >= next_checkpoint){
+			saveCheckpoint(checkpoint, defs, sites);
+			next_checkpoint = byte_count + checkpoint_bytes;
+		}
+	}
+	if (checkpoint){
+		saveCheckpoint(checkpoint, defs, sites);
 	}
+	acqfrDelete(fr);
+	ACQ_PERF_FRAMES(nframes);
+	ACQ_PERF_REPORT();
 }
 
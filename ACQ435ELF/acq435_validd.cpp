@@ -0,0 +1,647 @@
+/* ------------------------------------------------------------------------- *
+ * acq435_validd.cpp  		                     	                     *
+ * ------------------------------------------------------------------------- *
+ *   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <peter dot milne at D hyphen TACQ dot com>
+ *                         www.d-tacq.com
+ *    Author: pgm
+ *                                                                           *
+ *  This program is free software; you can redistribute it and/or modify     *
+ *  it under the terms of Version 2 of the GNU General Public License        *
+ *  as published by the Free Software Foundation;                            *
+ *                                                                           *
+ *  This program is distributed in the hope that it will be useful,          *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with this program; if not, write to the Free Software              *
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @file acq435_validd.cpp multi stream validation daemon.
+ *
+ * USAGE: acq435_validd [--control=SOCKET] [--workers=N]
+ *
+ * Streams are FIFOs or tcp:HOST:PORT, each served by one worker thread
+ * (pinned to a cpu) from that worker's epoll loop. The daemon is driven
+ * by line commands on a unix domain socket [/tmp/acq435_validd.sock]:
+ *
+ * add NAME SOURCE [nosid] [monitor_spad] [bitslice=LSB|MSB] SITE-DEF..
+ * del NAME
+ * stats [NAME]
+ * list
+ *
+ * eg: echo "add uut1 tcp:acq1001_044:4210 1=ABCDS" | nc -U /tmp/acq435_validd.sock
+ *
+ * Checks are those of acq435_validator: ES frames skipped, channel IDs,
+ * SPAD sample sequence, optional SPAD change count, bitslice d7 sequence.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <vector>
+#include <string>
+
+#include "acq-layout.h"
+#include "acq-util.h"
+#include "acq-numa.h"
+#include "acq-kernels.h"
+
+#define MAXEVENTS	16
+#define READ_FRAMES	1024		/* frames per read buffer */
+#define CONTROL_DEF	"/tmp/acq435_validd.sock"
+
+int verbose;
+
+class Stream {
+	std::vector<AcqLayout> sites;
+	std::vector<int> offsets;
+	int frame_words;
+	bool monitor_spad;
+	int bitslice;
+	unsigned* buf;
+	int fill;			/* bytes in buf */
+	unsigned* spad_cache;
+	std::vector<unsigned> samples;	/* per site */
+	unsigned d7;
+	bool first;
+
+	bool isES(const unsigned* frame) const {
+		for (int ii = 0; ii < ACQL_NES; ++ii){
+			if (frame[ii] != ACQL_ES_MAGIC){
+				return false;
+			}
+		}
+		return true;
+	}
+	unsigned collect_d7(const unsigned* frame) const {
+		unsigned xx = acqkCollectBits(frame, 7);
+		return bitslice == 'l'? xx: acqkReverse32(xx);
+	}
+	void validate(const unsigned* frame){
+		bool error = false;
+
+		if (isES(frame)){
+			++es_count;
+			return;
+		}
+		for (int si = 0; si < sites.size(); ++si){
+			const AcqLayout& lay = sites[si];
+			const unsigned* mydata = frame + offsets[si];
+			for (int ic = 0; ic < lay.nwords; ++ic){
+				switch(lay.kind[ic]){
+				case ACQL_ID:
+					if ((mydata[ic] ^ lay.ids[ic]) & lay.id_mask){
+						++id_errors;
+						error = true;
+					}
+					break;
+				case ACQL_SAMPLE:
+					if (!first && mydata[ic] != samples[si]+1){
+						++seq_errors;
+						error = true;
+					}
+					samples[si] = mydata[ic];
+					break;
+				case ACQL_SPAD:
+					if (monitor_spad){
+						unsigned* cache = spad_cache + offsets[si] + ic;
+						if (!first && *cache != mydata[ic]){
+							++spad_changes;
+						}
+						*cache = mydata[ic];
+					}
+					break;
+				default:
+					;
+				}
+			}
+		}
+		if (bitslice && frame_words >= 32){
+			unsigned new_d7 = collect_d7(frame);
+			if (!first && new_d7 != d7+1){
+				++bs_errors;
+				error = true;
+			}
+			d7 = new_d7;
+		}
+		if (error){
+			++errors;
+			last_error_byte = bytes;
+		}
+		first = false;
+	}
+public:
+	std::string name;
+	std::string source;
+	std::string defs;
+	int fd;
+	int worker;
+	const char* state;
+	bool connecting;		/* tcp connect in progress */
+	bool dead;			/* deleted, freed by the worker */
+
+	/* stats: written by the worker, read under the worker lock */
+	unsigned long long bytes;
+	unsigned long long frames;
+	unsigned long long errors;
+	unsigned long long id_errors;
+	unsigned long long seq_errors;
+	unsigned long long bs_errors;
+	unsigned long long spad_changes;
+	unsigned long long es_count;
+	unsigned long long last_error_byte;
+
+	Stream(const char* _name, const char* _source) :
+		frame_words(0), monitor_spad(false), bitslice(0),
+		buf(0), fill(0), spad_cache(0), d7(0), first(true),
+		name(_name), source(_source), fd(-1), worker(0), state("new"),
+		connecting(false), dead(false),
+		bytes(0), frames(0), errors(0), id_errors(0), seq_errors(0),
+		bs_errors(0), spad_changes(0), es_count(0), last_error_byte(0)
+	{}
+	~Stream() {
+		if (fd >= 0) close(fd);
+		acqFree(buf, frame_words*READ_FRAMES*sizeof(unsigned));
+		delete [] spad_cache;
+	}
+	/* returns 0 or an error message */
+	const char* configure(int argc, char* argv[]){
+		bool nosid = false;
+		char def[32];
+
+		for (int ii = 0; ii < argc; ++ii){
+			if (strcmp(argv[ii], "nosid") == 0){
+				nosid = true;
+			}else if (strcmp(argv[ii], "monitor_spad") == 0){
+				monitor_spad = true;
+			}else if (strcmp(argv[ii], "bitslice=LSB") == 0){
+				bitslice = 'l';
+			}else if (strcmp(argv[ii], "bitslice=MSB") == 0){
+				bitslice = 'm';
+			}else{
+				AcqLayout lay;
+				snprintf(def, sizeof(def), "%s%s", argv[ii],
+					bitslice == 'l' && sites.empty()? "l":
+					bitslice == 'm' && sites.empty()? "m": "");
+				if (acqLayoutCreate(&lay, strchr(argv[ii], '=')? def: argv[ii])){
+					return "bad site definition";
+				}
+				if (lay.bitslice && sites.empty()){
+					bitslice = lay.bitslice;
+				}
+				if (nosid){
+					lay.id_mask = 0x1f;
+				}
+				sites.push_back(lay);
+				offsets.push_back(frame_words);
+				samples.push_back(0);
+				frame_words += lay.nwords;
+				if (!defs.empty()) defs += " ";
+				defs += argv[ii];
+			}
+		}
+		if (frame_words == 0){
+			return "no sites";
+		}
+		buf = (unsigned*)acqAlloc(frame_words*READ_FRAMES*sizeof(unsigned));
+		spad_cache = new unsigned[frame_words];
+		memset(spad_cache, 0, frame_words*sizeof(unsigned));
+		return 0;
+	}
+	/* returns 0 or an error message */
+	const char* open(){
+		char host[128];
+		char port[16];
+
+		if (sscanf(source.c_str(), "tcp:%127[^:]:%15s", host, port) == 2){
+			struct addrinfo hints = {};
+			struct addrinfo* res;
+			hints.ai_socktype = SOCK_STREAM;
+			if (getaddrinfo(host, port, &hints, &res) != 0){
+				return "host not found";
+			}
+			/* the worker sees EPOLLOUT when the connect completes:
+			 * an unreachable host must not hold up the control loop */
+			fd = socket(res->ai_family, res->ai_socktype|SOCK_NONBLOCK,
+					res->ai_protocol);
+			if (fd < 0 || (connect(fd, res->ai_addr, res->ai_addrlen) != 0 &&
+					errno != EINPROGRESS)){
+				freeaddrinfo(res);
+				return strerror(errno);
+			}
+			freeaddrinfo(res);
+			connecting = true;
+			state = "connecting";
+			return 0;
+		}else{
+			struct stat sb;
+			if (stat(source.c_str(), &sb) != 0 || !S_ISFIFO(sb.st_mode)){
+				return "source must be a FIFO or tcp:HOST:PORT";
+			}
+			fd = ::open(source.c_str(), O_RDONLY|O_NONBLOCK);
+			if (fd < 0){
+				return strerror(errno);
+			}
+		}
+		state = "running";
+		return 0;
+	}
+	bool isFifo() const {
+		return strncmp(source.c_str(), "tcp:", 4) != 0;
+	}
+	/* one buffer fill per call, so a stream that never drains can't
+	 * starve the others on its worker. epoll is level triggered and
+	 * reports the fd again. returns false at end of stream */
+	bool onReadable(){
+		const int frame_bytes = frame_words*sizeof(unsigned);
+		const int buf_bytes = frame_bytes*READ_FRAMES;
+
+		int nr = read(fd, (char*)buf + fill, buf_bytes - fill);
+		if (nr < 0){
+			return errno == EAGAIN || errno == EINTR;
+		}else if (nr == 0){
+			return false;
+		}
+		fill += nr;
+		int nframes = fill / frame_bytes;
+		for (int ifr = 0; ifr < nframes; ++ifr){
+			validate(buf + ifr*frame_words);
+			bytes += frame_bytes;
+			++frames;
+		}
+		fill -= nframes*frame_bytes;
+		if (fill){
+			memmove(buf, (char*)buf + nframes*frame_bytes, fill);
+		}
+		return true;
+	}
+	/* non blocking connect done: returns false on failure */
+	bool onConnected(){
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		connecting = false;
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0){
+			err = errno;
+		}
+		if (err){
+			fprintf(stderr, "%s: connect %s: %s\n",
+				name.c_str(), source.c_str(), strerror(err));
+			return false;
+		}
+		state = "running";
+		return true;
+	}
+	void restart(){
+		first = true;
+		fill = 0;
+	}
+	void print(FILE* fp) const {
+		fprintf(fp, "%s %s worker:%d state:%s frames:%llu bytes:%llu "
+			"errors:%llu id:%llu seq:%llu bs:%llu spad_changes:%llu "
+			"es:%llu last_error:%llu defs:%s\n",
+			name.c_str(), source.c_str(), worker, state,
+			frames, bytes, errors, id_errors, seq_errors, bs_errors,
+			spad_changes, es_count, last_error_byte, defs.c_str());
+	}
+};
+
+class Worker {
+	int epfd;
+	int wakefd;		/* eventfd: graveyard not empty */
+	int index;
+	int cpu;
+	pthread_t thread;
+	/* streams deleted by the control thread. The worker may already
+	 * hold events for them from epoll_wait(), so it frees them itself
+	 * once that batch is done */
+	std::vector<Stream*> graveyard;
+
+	static void* _run(void* arg){
+		((Worker*)arg)->run();
+		return 0;
+	}
+	void hangup(Stream* stream){
+		epoll_ctl(epfd, EPOLL_CTL_DEL, stream->fd, 0);
+		close(stream->fd);
+		stream->fd = -1;
+		if (stream->isFifo() && stream->open() == 0){
+			/* wait for the next writer */
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN;
+			ev.data.ptr = stream;
+			stream->restart();
+			stream->state = "waiting";
+			epoll_ctl(epfd, EPOLL_CTL_ADD, stream->fd, &ev);
+		}else{
+			stream->state = "closed";
+		}
+	}
+	void run(){
+		struct epoll_event events[MAXEVENTS];
+
+		/* CPU_WORKER list overrides the default spread */
+		if (acqPinThread("WORKER", index) < 0 && cpu >= 0){
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu, &cpus);
+			pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		}
+		for (;;){
+			int nev = epoll_wait(epfd, events, MAXEVENTS, -1);
+			if (nev < 0 && errno != EINTR){
+				perror("epoll_wait");
+				return;
+			}
+			pthread_mutex_lock(&lock);
+			for (int iev = 0; iev < nev; ++iev){
+				Stream* stream = (Stream*)events[iev].data.ptr;
+				bool alive = true;
+				if (stream == 0){
+					unsigned long long kicks;
+					read(wakefd, &kicks, sizeof(kicks));
+					continue;
+				}else if (stream->dead){
+					continue;
+				}else if (stream->connecting){
+					alive = stream->onConnected();
+					if (alive){
+						struct epoll_event ev = {};
+						ev.events = EPOLLIN;
+						ev.data.ptr = stream;
+						epoll_ctl(epfd, EPOLL_CTL_MOD, stream->fd, &ev);
+					}
+				}else if (events[iev].events & EPOLLIN){
+					stream->state = "running";
+					alive = stream->onReadable();
+				}else if (events[iev].events & (EPOLLHUP|EPOLLERR)){
+					alive = false;
+				}
+				if (!alive){
+					hangup(stream);
+				}
+			}
+			for (unsigned ii = 0; ii < graveyard.size(); ++ii){
+				delete graveyard[ii];
+			}
+			graveyard.clear();
+			pthread_mutex_unlock(&lock);
+		}
+	}
+public:
+	pthread_mutex_t lock;		/* held while streams are serviced */
+
+	Worker(int _index, int _cpu) : index(_index), cpu(_cpu) {
+		struct epoll_event ev = {};
+
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		wakefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+		ev.events = EPOLLIN;
+		ev.data.ptr = 0;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+		pthread_mutex_init(&lock, 0);
+		pthread_create(&thread, 0, _run, this);
+	}
+	int add(Stream* stream){
+		struct epoll_event ev = {};
+		ev.events = stream->connecting? EPOLLOUT: EPOLLIN;
+		ev.data.ptr = stream;
+		return epoll_ctl(epfd, EPOLL_CTL_ADD, stream->fd, &ev);
+	}
+	/* call with lock held. The source is closed now, the Stream
+	 * is freed by the worker */
+	void del(Stream* stream){
+		unsigned long long kick = 1;
+
+		if (stream->fd >= 0){
+			epoll_ctl(epfd, EPOLL_CTL_DEL, stream->fd, 0);
+			close(stream->fd);
+			stream->fd = -1;
+		}
+		stream->dead = true;
+		stream->state = "deleted";
+		graveyard.push_back(stream);
+		write(wakefd, &kick, sizeof(kick));
+	}
+};
+
+class Daemon {
+	std::vector<Worker*> workers;
+	std::vector<Stream*> streams;
+	int next_worker;
+
+	Stream* find(const char* name){
+		for (int ii = 0; ii < streams.size(); ++ii){
+			if (streams[ii]->name == name){
+				return streams[ii];
+			}
+		}
+		return 0;
+	}
+	void add(FILE* reply, int argc, char* argv[]){
+		if (argc < 4){
+			fprintf(reply, "ERROR USAGE: add NAME SOURCE SITE-DEF..\n");
+			return;
+		}
+		if (find(argv[1])){
+			fprintf(reply, "ERROR %s exists\n", argv[1]);
+			return;
+		}
+		Stream* stream = new Stream(argv[1], argv[2]);
+		const char* err;
+		if ((err = stream->configure(argc-3, argv+3)) != 0 ||
+		    (err = stream->open()) != 0){
+			fprintf(reply, "ERROR %s: %s\n", argv[1], err);
+			delete stream;
+			return;
+		}
+		stream->worker = next_worker++ % workers.size();
+		Worker* worker = workers[stream->worker];
+		pthread_mutex_lock(&worker->lock);
+		streams.push_back(stream);
+		worker->add(stream);
+		pthread_mutex_unlock(&worker->lock);
+		fprintf(reply, "OK %s worker:%d\n", argv[1], stream->worker);
+	}
+	void del(FILE* reply, const char* name){
+		Stream* stream = find(name);
+		if (!stream){
+			fprintf(reply, "ERROR %s not found\n", name);
+			return;
+		}
+		Worker* worker = workers[stream->worker];
+		pthread_mutex_lock(&worker->lock);
+		for (int ii = 0; ii < streams.size(); ++ii){
+			if (streams[ii] == stream){
+				streams.erase(streams.begin()+ii);
+				break;
+			}
+		}
+		stream->print(reply);
+		worker->del(stream);
+		pthread_mutex_unlock(&worker->lock);
+		fprintf(reply, "OK\n");
+	}
+	void stats(FILE* reply, const char* name){
+		for (int ii = 0; ii < streams.size(); ++ii){
+			Stream* stream = streams[ii];
+			if (name == 0 || stream->name == name){
+				Worker* worker = workers[stream->worker];
+				pthread_mutex_lock(&worker->lock);
+				stream->print(reply);
+				pthread_mutex_unlock(&worker->lock);
+			}
+		}
+		fprintf(reply, "OK\n");
+	}
+public:
+	Daemon(int nworkers) : next_worker(0) {
+		int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int iw = 0; iw < nworkers; ++iw){
+			workers.push_back(new Worker(iw, ncpus > 1? iw % ncpus: -1));
+		}
+	}
+	void command(FILE* reply, char* line){
+		char* argv[64];
+		int argc;
+		char* cursor = line + strlen(line);
+
+		while (cursor > line && (cursor[-1] == '\n' || cursor[-1] == '\r')){
+			*--cursor = '\0';
+		}
+		argc = strsplit(line, argv, 63, " ");
+		if (argc < 1 || argv[0][0] == '\0'){
+			return;
+		}
+		if (strcmp(argv[0], "add") == 0){
+			add(reply, argc, argv);
+		}else if (strcmp(argv[0], "del") == 0 && argc == 2){
+			del(reply, argv[1]);
+		}else if (strcmp(argv[0], "stats") == 0){
+			stats(reply, argc > 1? argv[1]: 0);
+		}else if (strcmp(argv[0], "list") == 0){
+			for (int ii = 0; ii < streams.size(); ++ii){
+				fprintf(reply, "%s %s %s\n", streams[ii]->name.c_str(),
+					streams[ii]->source.c_str(),
+					streams[ii]->defs.c_str());
+			}
+			fprintf(reply, "OK\n");
+		}else{
+			fprintf(reply, "ERROR unknown command \"%s\"\n", argv[0]);
+		}
+		fflush(reply);
+	}
+};
+
+namespace UI {
+	const char* control = CONTROL_DEF;
+	int workers = 0;
+};
+
+int control_socket(const char* path)
+{
+	struct sockaddr_un addr = {};
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, 8) != 0){
+		perror(path);
+		exit(1);
+	}
+	return fd;
+}
+
+/* control loop: one epoll set, listener plus client connections */
+int serve(Daemon& daemon, int lfd)
+{
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = {};
+	struct epoll_event events[MAXEVENTS];
+
+	ev.events = EPOLLIN;
+	ev.data.fd = lfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	for (;;){
+		int nev = epoll_wait(epfd, events, MAXEVENTS, -1);
+		if (nev < 0 && errno != EINTR){
+			perror("epoll_wait");
+			return 1;
+		}
+		for (int iev = 0; iev < nev; ++iev){
+			int fd = events[iev].data.fd;
+			if (fd == lfd){
+				int cfd = accept4(lfd, 0, 0, SOCK_CLOEXEC);
+				if (cfd >= 0){
+					ev.events = EPOLLIN;
+					ev.data.fd = cfd;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+				}
+				continue;
+			}
+			char line[1024];
+			int nr = read(fd, line, sizeof(line)-1);
+			if (nr <= 0){
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
+				close(fd);
+				continue;
+			}
+			line[nr] = '\0';
+			FILE* reply = fdopen(dup(fd), "w");
+			char* save;
+			for (char* cmd = strtok_r(line, "\n", &save); cmd;
+					cmd = strtok_r(0, "\n", &save)){
+				daemon.command(reply, cmd);
+			}
+			fclose(reply);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (getenv("VERBOSE")){
+		verbose = atoi(getenv("VERBOSE"));
+	}
+	for (int ii = 1; ii < argc; ++ii){
+		static char control[108];
+		if (sscanf(argv[ii], "--control=%107s", control) == 1){
+			UI::control = control;
+		}else if (sscanf(argv[ii], "--workers=%d", &UI::workers) == 1){
+			;
+		}else{
+			fprintf(stderr, "USAGE: acq435_validd "
+				"[--control=SOCKET] [--workers=N]\n");
+			return 1;
+		}
+	}
+	if (UI::workers < 1){
+		UI::workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (UI::workers < 1) UI::workers = 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	Daemon daemon(UI::workers);
+	return serve(daemon, control_socket(UI::control));
+}
@@ -28,11 +28,17 @@
 
 #include <vector>
 #include <time.h>
+
+#include "acq-numa.h"
+#include "acq-perf.h"
+#include "acq-kernels.h"
 #define MAXWORDS	66
 
 #define ES_MAGIC 	0xaa55f151
 #define NES		4
 
+#define BLOCK_FRAMES	1024
+
 
 bool verbose;
 
@@ -53,6 +59,8 @@ protected:
 	unsigned* spad_cache;
 	unsigned offset;
 	unsigned sample;
+	unsigned idm[16];		/* ids & ID_MASK */
+	unsigned idmask[16];
 
 	enum IDS {
 		IDS_NOCHECK = 0,
@@ -85,6 +93,8 @@ protected:
 
 		for (int ic = 0; ic < nwords; ++ic){
 			ids[ic] = sid | cid(ic);
+			idm[ic] = ids[ic] & ID_MASK;
+			idmask[ic] = ID_MASK;
 		}
 	}
 public:
@@ -111,6 +121,16 @@ public:
 		}
 		printf("%16lld ES detected %08x at 0x%08x, %d\n",
 				byte_count, data[0], data[NES], data[NES]);
+		return true;
+	}
+	void idTable(unsigned* _idm, unsigned* _mask) const {
+		memcpy(_idm, idm, sizeof(idm));
+		memcpy(_mask, idmask, sizeof(idmask));
+	}
+	/* fast path: all 16 words are IDs, one reduced compare per frame.
+	 * the caller has already dealt with ES frames */
+	bool idsValid(const unsigned *data) const {
+		return acqkIdCheck(data+offset, idm, idmask, 16) == 0;
 	}
 	virtual bool isValid(unsigned *data){
 		unsigned *mydata = data+offset;
@@ -124,7 +144,7 @@ public:
 			bool this_error = false;
 
 
-			switch(ids[ic]){
+			switch(int(ids[ic])){
 			case IDS_NOCHECK:
 				break;
 			case IDS_SPAD:
@@ -166,7 +186,7 @@ public:
 
 		if (print_spad){
 			for (int ic = 0; ic < nwords; ++ic){
-				switch(ids[ic]){
+				switch(int(ids[ic])){
 				case IDS_SPAD:
 				case IDS_SAMPLE:
 					printf("%08x ", mydata[ic]);
@@ -248,29 +268,86 @@ int main(int argc, char* argv[])
 	}
 
 	int sample_size = 0;
+	std::vector<unsigned> frame_idm;
+	std::vector<unsigned> frame_mask;
 	for (int si = 0; si < sites.size(); ++si){
 		ACQ437_Data* module = sites.at(si);
 		module->setOffset(sample_size);
 		module->print();
 		sample_size += module->getNwords();
+		frame_idm.resize(sample_size);
+		frame_mask.resize(sample_size);
+		module->idTable(&frame_idm[sample_size-16],
+					&frame_mask[sample_size-16]);
 	}
 	//ACQ435_Data::create(argv[ii])->print();
 
-	unsigned* buf = new unsigned[sample_size];
-
-
-	while(fread(buf, sizeof(unsigned), sample_size, stdin) == sample_size){
-		for (int si = 0; si < sites.size(); ++si){
-			ACQ437_Data* module = sites.at(si);
-			if (!module->isValid(buf)){
-				printf("ERROR at %lld site:%d\n",
-						byte_count, si);
-				++ecount;
+	const int block_words = sample_size * BLOCK_FRAMES;
+	unsigned* block = (unsigned*)acqAlloc(block_words*sizeof(unsigned));
+	std::vector<int> site_errors(sites.size());
+	int nread;
+	unsigned long long frames = 0;
+
+	acqPinThread("VALIDATOR", 0);
+	acqBufferStream(stdin);
+
+	/* blocks of frames. frames failing the fast check, or any frame
+	 * with verbose set, take the per word path for the diagnostics.
+	 * perf: ES detect is part of the per block ID stage */
+	for (;;){
+		ACQ_PERF_BEGIN(ACQP_READ);
+		nread = fread(block, sizeof(unsigned), block_words, stdin);
+		ACQ_PERF_END(ACQP_READ);
+		if (nread < sample_size){
+			break;
+		}
+		int nframes = nread / sample_size;
+		frames += nframes;
+		ACQ_PERF_BEGIN(ACQP_ID);
+		for (int iframe = 0; iframe < nframes; ++iframe){
+			unsigned* buf = block + iframe*sample_size;
+			if (buf[0] == ES_MAGIC && sites[0]->isES(buf)){
+				/* one ES line per site, as each site reported it */
+				for (int si = 1; si < sites.size(); ++si){
+					sites[si]->isES(buf);
+				}
+				byte_count += sample_size * sizeof(unsigned);
+				continue;
 			}
+			/* one dispatched check over the whole frame, sites
+			 * only when it fails */
+			if (!verbose && acqkIdCheck(buf, &frame_idm[0],
+					&frame_mask[0], sample_size) == 0){
+				byte_count += sample_size * sizeof(unsigned);
+				continue;
+			}
+			for (int si = 0; si < sites.size(); ++si){
+				ACQ437_Data* module = sites[si];
+				if (!verbose && module->idsValid(buf)){
+					continue;
+				}
+				if (!module->isValid(buf)){
+					printf("ERROR at %lld site:%d\n",
+							byte_count, si);
+					++site_errors[si];
+					++ecount;
+				}
+			}
+			byte_count += sample_size * sizeof(unsigned);
+		}
+		ACQ_PERF_END(ACQP_ID);
+		if (nread < block_words){
+			break;
 		}
-		byte_count += sample_size * sizeof(unsigned);
 	}
 
+	for (int si = 0; si < sites.size(); ++si){
+		if (site_errors[si]){
+			printf("site:%d errors:%d\n", si, site_errors[si]);
+		}
+	}
 	printf("byte_count:%lld ecount:%d\n", byte_count, ecount);
+	ACQ_PERF_FRAMES(frames);
+	ACQ_PERF_REPORT();
 }
 
@@ -0,0 +1,325 @@
+/* ------------------------------------------------------------------------- *
+ * acq_inspect.cpp  		                     	                     *
+ * ------------------------------------------------------------------------- *
+ *   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <peter dot milne at D hyphen TACQ dot com>
+ *                         www.d-tacq.com
+ *    Author: pgm
+ *                                                                           *
+ *  This program is free software; you can redistribute it and/or modify     *
+ *  it under the terms of Version 2 of the GNU General Public License        *
+ *  as published by the Free Software Foundation;                            *
+ *                                                                           *
+ *  This program is distributed in the hope that it will be useful,          *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with this program; if not, write to the Free Software              *
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @file acq_inspect.cpp random access frame inspector
+ *
+ * USAGE: acq_inspect [opts] FILE [site-def ...|auto]
+ *
+ * --offset=BYTES   frame containing byte offset, eg a validator byte_count
+ * --sample=N       Nth data frame (from 0), ES frames are not samples
+ * --es=N           Nth ES frame (from 0), from FILE.esi when current
+ * --count=N        frames to print [4]
+ * --all            print every frame
+ * --words=N        no site defs: raw frames of N words, eg 48 as hex48
+ * --mkindex        write FILE.esi
+ *
+ * With site defs each word is annotated site/bank/channel and ID
+ * mismatches and SPAD sample count breaks are flagged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "acq-layout.h"
+#include "acq-esi.h"
+
+namespace UI {
+	long long offset = -1;
+	long long sample = -1;
+	int es = -1;
+	long long count = 4;
+	int words = 0;
+	bool mkindex = false;
+	const char* fname = 0;
+};
+
+class Inspector {
+	const char* base;
+	unsigned long long len;
+	std::vector<AcqLayout> sites;
+	std::vector<int> offsets;
+	int frame_words;
+	unsigned long long origin;	/* bytes before the first whole frame */
+	AcqEsiEntry* es;
+	int nes;
+
+	const unsigned* frame(unsigned long long iframe) const {
+		return (const unsigned*)(base + origin + iframe*frameBytes());
+	}
+	void printRaw(const unsigned* fp) const {
+		for (int iw = 0; iw < frame_words; ++iw){
+			printf("%08x%c", fp[iw], iw%12 == 11? '\n': ' ');
+		}
+		if (frame_words%12) printf("\n");
+	}
+	void printWord(const AcqLayout& lay, int ic, unsigned xx,
+			const unsigned* prev) const {
+		printf("  %3d %08x s%d ", ic, xx, lay.site);
+		switch(lay.kind[ic]){
+		case ACQL_ID: {
+			int id = lay.ids[ic] & 0x1f;
+			bool bad = ((xx ^ lay.ids[ic]) & lay.id_mask) != 0;
+			if (lay.module == 437){
+				printf("ch%02d     %8d", id+1, (int)xx >> 8);
+			}else{
+				printf("%c ch%02d   %8d", lay.actual_banks[ic/4],
+						id+1, (int)xx >> 8);
+			}
+			if (bad){
+				printf("  ! ID want %02x", lay.ids[ic] & lay.id_mask);
+			}
+			break;
+		}
+		case ACQL_PMOD:
+			printf("PMOD");
+			break;
+		case ACQL_SAMPLE:
+			printf("SAMPLE   %8u", xx);
+			if (prev && xx != prev[ic]+1){
+				printf("  ! SEQ want %08x", prev[ic]+1);
+			}
+			break;
+		case ACQL_SPAD:
+			printf("SPAD");
+			break;
+		}
+		printf("\n");
+	}
+public:
+	Inspector(const char* _base, unsigned long long _len) :
+		base(_base), len(_len), frame_words(0), origin(0), es(0), nes(0)
+	{}
+	int addSite(const char* def){
+		AcqLayout lay;
+		if (acqLayoutCreate(&lay, def) != 0){
+			return -1;
+		}
+		sites.push_back(lay);
+		offsets.push_back(frame_words);
+		frame_words += lay.nwords;
+		return 0;
+	}
+	int autodetect(){
+		AcqLayout lays[6];
+		int skip;
+		unsigned long long nb = len < 0x100000? len: 0x100000;
+		int nsites = acqLayoutDetect((const unsigned*)base,
+				nb/sizeof(unsigned), lays, 6, &skip);
+		printf("# AUTODETECT:");
+		for (int si = 0; si < nsites; ++si){
+			char def[32];
+			acqLayoutDef(&lays[si], def, sizeof(def));
+			printf(" %s%s", def, lays[si].id_mask == 0x1f? " NOSID": "");
+			sites.push_back(lays[si]);
+			offsets.push_back(frame_words);
+			frame_words += lays[si].nwords;
+		}
+		printf("\n");
+		origin = skip*sizeof(unsigned);
+		return nsites? 0: -1;
+	}
+	void setRawWords(int words){
+		frame_words = words;
+	}
+	unsigned long long originBytes() const {
+		return origin;
+	}
+	int frameBytes() const {
+		return frame_words * sizeof(unsigned);
+	}
+	unsigned long long nframes() const {
+		return (len - origin) / frameBytes();
+	}
+	void loadIndex(const char* fname){
+		nes = acqEsiGet(fname, base + origin, len - origin,
+				frameBytes(), &es);
+		if (nes < 0){
+			nes = 0;
+		}
+	}
+	int mkindex(const char* fname){
+		nes = acqEsiScan(base + origin, len - origin, frameBytes(), &es);
+		if (nes < 0){
+			nes = 0;
+			return -1;
+		}
+		printf("# %s.esi %d ES\n", fname, nes);
+		return acqEsiSave(fname, frameBytes(), len - origin, es, nes);
+	}
+	int esFrame(int ies, unsigned long long* iframe) const {
+		if (ies < 0 || ies >= nes){
+			fprintf(stderr, "ERROR: ES %d not found, %d ES\n", ies, nes);
+			return -1;
+		}
+		*iframe = es[ies].offset / frameBytes();
+		return 0;
+	}
+	/* ES frames carry no sample: each one before sample N moves it on */
+	unsigned long long sampleFrame(unsigned long long sample) const {
+		unsigned long long iframe = sample;
+		for (int ies = 0; ies < nes; ++ies){
+			if (es[ies].offset / frameBytes() > iframe){
+				break;
+			}
+			++iframe;
+		}
+		return iframe;
+	}
+	void print(unsigned long long iframe) const {
+		const unsigned* fp = frame(iframe);
+		const unsigned* prev = iframe? frame(iframe-1): 0;
+
+		if (prev && acqEsiIsES(prev)){
+			prev = iframe > 1? frame(iframe-2): 0;
+		}
+		printf("frame %llu offset %llu", iframe,
+				origin + iframe*frameBytes());
+		if (acqEsiIsES(fp)){
+			printf(" ES sample %u\n", fp[4]);
+			printRaw(fp);
+			return;
+		}
+		printf("\n");
+		if (sites.empty()){
+			printRaw(fp);
+			return;
+		}
+		for (int si = 0; si < sites.size(); ++si){
+			for (int ic = 0; ic < sites[si].nwords; ++ic){
+				printWord(sites[si], ic, fp[offsets[si]+ic],
+					prev? prev + offsets[si]: 0);
+			}
+		}
+	}
+};
+
+void ui(int argc, char* argv[], std::vector<const char*>& defs)
+{
+	for (int ii = 1; ii < argc; ++ii){
+		const char* this_arg = argv[ii];
+
+		if (sscanf(this_arg, "--offset=%lld", &UI::offset) == 1 ||
+		    sscanf(this_arg, "--sample=%lld", &UI::sample) == 1 ||
+		    sscanf(this_arg, "--es=%d", &UI::es) == 1 ||
+		    sscanf(this_arg, "--count=%lld", &UI::count) == 1 ||
+		    sscanf(this_arg, "--words=%d", &UI::words) == 1){
+			;
+		}else if (strcmp(this_arg, "--all") == 0){
+			UI::count = -1;
+		}else if (strcmp(this_arg, "--mkindex") == 0){
+			UI::mkindex = true;
+		}else if (this_arg[0] == '-'){
+			fprintf(stderr, "ERROR: unknown option \"%s\"\n", this_arg);
+			exit(1);
+		}else if (!UI::fname){
+			UI::fname = this_arg;
+		}else{
+			defs.push_back(this_arg);
+		}
+	}
+	if (!UI::fname || (defs.empty() && UI::words <= 0)){
+		fprintf(stderr, "USAGE: acq_inspect [--offset=N|--sample=N|--es=N] "
+			"[--count=N|--all] [--mkindex] FILE site-def..|auto\n"
+			"       acq_inspect --words=N FILE\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<const char*> defs;
+	ui(argc, argv, defs);
+
+	int fd = open(UI::fname, O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0){
+		perror(UI::fname);
+		return 1;
+	}
+	if (sb.st_size == 0){
+		fprintf(stderr, "ERROR: %s is empty\n", UI::fname);
+		return 1;
+	}
+	const char* base = (const char*)mmap(0, sb.st_size, PROT_READ,
+							MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+	Inspector insp(base, sb.st_size);
+
+	if (defs.size() == 1 && strcmp(defs[0], "auto") == 0){
+		if (insp.autodetect() != 0){
+			fprintf(stderr, "ERROR: AUTODETECT no layout found\n");
+			return 1;
+		}
+	}else if (defs.empty()){
+		insp.setRawWords(UI::words);
+	}else{
+		for (int ii = 0; ii < defs.size(); ++ii){
+			if (insp.addSite(defs[ii]) != 0){
+				fprintf(stderr, "ERROR: failed to create site \"%s\"\n",
+						defs[ii]);
+				return 1;
+			}
+		}
+	}
+	if (UI::mkindex){
+		return insp.mkindex(UI::fname) == 0? 0: 1;
+	}
+
+	unsigned long long iframe = 0;
+	if (UI::es >= 0){
+		insp.loadIndex(UI::fname);
+		if (insp.esFrame(UI::es, &iframe) != 0){
+			return 1;
+		}
+	}else if (UI::sample >= 0){
+		insp.loadIndex(UI::fname);
+		iframe = insp.sampleFrame(UI::sample);
+	}else if (UI::offset >= 0){
+		long long rel = UI::offset - insp.originBytes();
+		iframe = rel < 0? 0: rel / insp.frameBytes();
+		if (rel >= 0 && rel % insp.frameBytes()){
+			printf("# offset %lld is %lld bytes into frame %llu\n",
+				UI::offset, rel % insp.frameBytes(), iframe);
+		}
+	}
+	unsigned long long nframes = insp.nframes();
+	if (iframe >= nframes){
+		fprintf(stderr, "ERROR: frame %llu beyond end, %llu frames\n",
+				iframe, nframes);
+		return 1;
+	}
+	for (long long ii = 0; iframe < nframes && ii != UI::count; ++ii){
+		insp.print(iframe++);
+	}
+	return 0;
+}
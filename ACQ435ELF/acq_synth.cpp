@@ -0,0 +1,432 @@
+/* ------------------------------------------------------------------------- *
+ * acq_synth.cpp  		                     	                     *
+ * ------------------------------------------------------------------------- *
+ *   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <peter dot milne at D hyphen TACQ dot com>
+ *                         www.d-tacq.com
+ *    Author: pgm
+ *                                                                           *
+ *  This program is free software; you can redistribute it and/or modify     *
+ *  it under the terms of Version 2 of the GNU General Public License        *
+ *  as published by the Free Software Foundation;                            *
+ *                                                                           *
+ *  This program is distributed in the hope that it will be useful,          *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with this program; if not, write to the Free Software              *
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @file acq_synth.cpp synthetic ACQ435/ACQ437 stream generator.
+ *
+ * USAGE: acq_synth [opts] site-def [site-def ...] > stream
+ *   site-def as acq435_validator (1=ABCDS, 1=ABCDl) or 1=437
+ *   --frames=N       frames to generate, 0: until the output closes
+ *   --es=N           insert an ES frame before every N'th frame
+ *   --crc=1          ES frames carry the per-site crc32 for crc_validate
+ *   --sc0=N          first bitslice sample count
+ *   --noise=BITS     pseudo random noise added to the ramp data
+ *   --fault_id=N     corrupt one channel ID every N frames
+ *   --fault_seq=N    skip the SPAD sample count every N frames
+ *   --fault_bs=N     skip the bitslice sample count every N frames
+ *   --fault_drop=N   drop one word every N frames
+ *   --seed=N         fault position and noise seed
+ *   --threads=N      generator threads, default: all cpus
+ *   --outfile=FILE   default stdout
+ *
+ * Frame n (from 0) has SPAD sample n+1 and bitslice count sc0+n.
+ * Output depends only on the options, never on the thread count.
+ * Bitslice bits are carried on ID words among the first 32 words.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <vector>
+
+#include "acq-layout.h"
+#include "acq-numa.h"
+#include "acq-trace.h"
+#include "acq-kernels.h"
+
+#define BLOCK_BYTES	0x100000	/* target size of a generator block */
+
+int verbose;
+
+namespace UI {
+	unsigned long long frames = 0;
+	unsigned es_interval = 0;
+	int crc = 0;
+	unsigned sc0 = 0;
+	int noise = 0;
+	unsigned fault_id = 0;
+	unsigned fault_seq = 0;
+	unsigned fault_bs = 0;
+	unsigned fault_drop = 0;
+	unsigned seed = 1;
+	int threads = 0;
+	FILE* fout = stdout;
+};
+
+
+static inline unsigned hash(unsigned long long xx)
+{
+	xx ^= xx >> 33;
+	xx *= 0xff51afd7ed558ccdULL;
+	xx ^= xx >> 33;
+	xx *= 0xc4ceb9fe1a85ec53ULL;
+	xx ^= xx >> 33;
+	return (unsigned)xx;
+}
+
+class FrameGenerator {
+	std::vector<AcqLayout> sites;
+	std::vector<int> offsets;
+	int frame_words;
+	int bitslice;		/* from the first site */
+	unsigned* template_ids;	/* per word, low byte before bitslice */
+	bool* is_id;
+
+	unsigned data24(int iw, unsigned long long n) const {
+		unsigned xx = unsigned(n * (iw+1) * 37) & 0x00ffffff;
+		if (UI::noise){
+			xx += hash(n << 8 ^ iw ^ (unsigned long long)UI::seed << 40)
+						& ((1U << UI::noise) - 1);
+		}
+		return xx & 0x00ffffff;
+	}
+	unsigned bsbits(int iw, unsigned long long n) const {
+		unsigned d7 = UI::sc0 + unsigned(n);
+		unsigned d6 = unsigned(n >> 12);
+		unsigned d5 = unsigned(n >> 20);
+		int bit = bitslice == 'l'? iw: 31 - iw;
+
+		if (UI::fault_bs && n && n%UI::fault_bs == 0){
+			d7 += 1;
+		}
+		return ((d7 >> bit)&1) << 7 |
+			((d6 >> bit)&1) << 6 |
+			((d5 >> bit)&1) << 5;
+	}
+public:
+	FrameGenerator() : frame_words(0), bitslice(0),
+		template_ids(0), is_id(0)
+	{}
+	int addSite(const char* def){
+		AcqLayout lay;
+		if (acqLayoutCreate(&lay, def) != 0){
+			return -1;
+		}
+		if (sites.empty()){
+			bitslice = lay.bitslice;
+		}
+		sites.push_back(lay);
+		offsets.push_back(frame_words);
+		frame_words += lay.nwords;
+		return 0;
+	}
+	void init() {
+		template_ids = new unsigned[frame_words];
+		is_id = new bool[frame_words];
+		for (unsigned si = 0; si < sites.size(); ++si){
+			const AcqLayout& lay = sites[si];
+			for (int ic = 0; ic < lay.nwords; ++ic){
+				int iw = offsets[si] + ic;
+				is_id[iw] = lay.kind[ic] == ACQL_ID;
+				template_ids[iw] = is_id[iw]? lay.ids[ic]: 0;
+				if (is_id[iw] && bitslice){
+					template_ids[iw] &= 0x1f;
+				}
+			}
+		}
+	}
+	int frameWords() const {
+		return frame_words;
+	}
+	bool isES(unsigned long long n) const {
+		return UI::es_interval && n && n%UI::es_interval == 0;
+	}
+	/* ES: every group of 8 words is 4 x magic, sample, crc, sample, crc */
+	void es(unsigned* frame, unsigned long long n) const {
+		for (int iw = 0; iw < frame_words; ++iw){
+			switch(iw%8){
+			case 4:
+			case 6:
+				frame[iw] = unsigned(n);
+				break;
+			case 5:
+			case 7:
+				frame[iw] = 0;		/* crc, filled by writer */
+				break;
+			default:
+				frame[iw] = ACQL_ES_MAGIC;
+			}
+		}
+	}
+	void frame(unsigned* frame, unsigned long long n) const {
+		for (int iw = 0; iw < frame_words; ++iw){
+			if (is_id[iw]){
+				unsigned id = template_ids[iw];
+				if (bitslice && iw < 32){
+					id |= bsbits(iw, n);
+				}
+				frame[iw] = data24(iw, n) << 8 | id;
+			}
+		}
+		for (unsigned si = 0; si < sites.size(); ++si){
+			const AcqLayout& lay = sites[si];
+			for (int ic = lay.nbanks*8; ic < lay.nwords; ++ic){
+				unsigned* pw = frame + offsets[si] + ic;
+				switch(lay.kind[ic]){
+				case ACQL_ID:
+					break;
+				case ACQL_SAMPLE:
+					*pw = unsigned(n) + 1;
+					if (UI::fault_seq && n && n%UI::fault_seq == 0){
+						*pw += 1;
+					}
+					break;
+				case ACQL_SPAD:
+					*pw = unsigned(n >> 16);
+					break;
+				default:
+					*pw = 0;
+				}
+			}
+		}
+		if (UI::fault_id && n && n%UI::fault_id == 0){
+			int iw = hash(n ^ UI::seed) % frame_words;
+			frame[iw] ^= 0x1f;
+		}
+	}
+	/* returns words generated, dropped words are squeezed out */
+	int generate(unsigned* buf, unsigned long long n0, int nframes) const {
+		unsigned* cursor = buf;
+		for (unsigned long long n = n0; n < n0 + nframes; ++n){
+			if (isES(n)){
+				es(cursor, n);
+				cursor += frame_words;
+			}
+			frame(cursor, n);
+			if (UI::fault_drop && n && n%UI::fault_drop == 0){
+				int iw = hash(n ^ UI::seed ^ 0x5a5a) % frame_words;
+				memmove(cursor+iw, cursor+iw+1,
+					(frame_words-iw-1)*sizeof(unsigned));
+				cursor += frame_words - 1;
+			}else{
+				cursor += frame_words;
+			}
+		}
+		return cursor - buf;
+	}
+	/* crc_validate: crc32 of each site's frames since the last ES */
+	void crc(unsigned* buf, int nwords, unsigned* crcs) const {
+		for (int iw = 0; iw + frame_words <= nwords; iw += frame_words){
+			unsigned* frame = buf + iw;
+			if (frame[0] == ACQL_ES_MAGIC &&
+			    frame[ACQL_NES-1] == ACQL_ES_MAGIC){
+				for (unsigned si = 0; si < sites.size(); ++si){
+					unsigned* site_es = frame + offsets[si];
+					site_es[5] = site_es[7] = crcs[si];
+					crcs[si] = 0;
+				}
+			}else{
+				for (unsigned si = 0; si < sites.size(); ++si){
+					crcs[si] = acqkCrc32(crcs[si], frame + offsets[si],
+						sites[si].nwords*sizeof(unsigned));
+				}
+			}
+		}
+	}
+	int nsites() const {
+		return sites.size();
+	}
+};
+
+struct Block {
+	unsigned* buf;
+	int nwords;
+	unsigned long long n0;
+	int nframes;
+	sem_t full;
+	sem_t empty;
+};
+
+class Synth {
+	FrameGenerator& gen;
+	int nthreads;
+	int frames_per_block;
+	std::vector<Block> blocks;	/* block ib belongs to thread ib%nthreads */
+	unsigned long long nblocks;	/* 0: no limit */
+	volatile bool stop;
+
+	struct Worker {
+		Synth* synth;
+		int ithread;
+	};
+	static void* _work(void* arg) {
+		Worker* w = (Worker*)arg;
+		w->synth->work(w->ithread);
+		return 0;
+	}
+	/* the writer round robins over slots, so output order is fixed */
+	void work(int ithread) {
+		acqPinThread("WORKER", ithread);
+		ACQ_TRACE_THREAD("worker");
+		for (unsigned long long ib = ithread; !nblocks || ib < nblocks;
+							ib += nthreads){
+			Block& b = blocks[ib % blocks.size()];
+			sem_wait(&b.empty);
+			if (stop){
+				return;
+			}
+			b.n0 = ib * frames_per_block;
+			b.nframes = frames_per_block;
+			if (UI::frames && b.n0 + b.nframes > UI::frames){
+				b.nframes = UI::frames - b.n0;
+			}
+			ACQ_TRACE_BEGIN("generate");
+			b.nwords = gen.generate(b.buf, b.n0, b.nframes);
+			ACQ_TRACE_END("generate");
+			sem_post(&b.full);
+		}
+	}
+public:
+	Synth(FrameGenerator& _gen, int _nthreads) :
+		gen(_gen), nthreads(_nthreads), stop(false)
+	{
+		int frame_bytes = gen.frameWords() * sizeof(unsigned);
+		frames_per_block = BLOCK_BYTES / frame_bytes;
+		if (frames_per_block < 1) frames_per_block = 1;
+		nblocks = UI::frames?
+			(UI::frames + frames_per_block - 1) / frames_per_block: 0;
+
+		/* worst case, every frame preceded by ES */
+		int maxwords = 2 * frames_per_block * gen.frameWords();
+		blocks.resize(2 * nthreads);
+		for (unsigned ib = 0; ib < blocks.size(); ++ib){
+			blocks[ib].buf = (unsigned*)acqAlloc(maxwords*sizeof(unsigned));
+			sem_init(&blocks[ib].full, 0, 0);
+			sem_init(&blocks[ib].empty, 0, 1);
+		}
+	}
+	int operator() (FILE* fout) {
+		std::vector<pthread_t> threads(nthreads);
+		std::vector<Worker> workers(nthreads);
+		unsigned* crcs = new unsigned[gen.nsites()];
+		unsigned long long bytes = 0;
+		int rc = 0;
+
+		memset(crcs, 0, gen.nsites()*sizeof(unsigned));
+		acqPinThread("WRITER", 0);
+		ACQ_TRACE_THREAD("writer");
+		for (int it = 0; it < nthreads; ++it){
+			workers[it].synth = this;
+			workers[it].ithread = it;
+			pthread_create(&threads[it], 0, _work, &workers[it]);
+		}
+		for (unsigned long long ib = 0; !nblocks || ib < nblocks; ++ib){
+			Block& b = blocks[ib % blocks.size()];
+			ACQ_TRACE_BEGIN("wait");
+			sem_wait(&b.full);
+			ACQ_TRACE_END("wait");
+			ACQ_TRACE_BEGIN("write");
+			if (UI::crc){
+				gen.crc(b.buf, b.nwords, crcs);
+			}
+			if (fwrite(b.buf, sizeof(unsigned), b.nwords, fout) !=
+							size_t(b.nwords)){
+				ACQ_TRACE_END("write");
+				if (errno != EPIPE){
+					perror("acq_synth write");
+					rc = 1;
+				}
+				break;
+			}
+			ACQ_TRACE_END("write");
+			bytes += b.nwords * sizeof(unsigned);
+			sem_post(&b.empty);
+		}
+		fflush(fout);
+
+		stop = true;
+		for (unsigned ib = 0; ib < blocks.size(); ++ib){
+			sem_post(&blocks[ib].empty);
+		}
+		for (int it = 0; it < nthreads; ++it){
+			pthread_join(threads[it], 0);
+		}
+		if (verbose){
+			fprintf(stderr, "acq_synth: %llu bytes\n", bytes);
+		}
+		return rc;
+	}
+};
+
+void ui(FrameGenerator& gen, int argc, char* argv[])
+{
+	for (int ii = 1; ii < argc; ++ii){
+		const char* this_arg = argv[ii];
+		char fname[128];
+
+		if (sscanf(this_arg, "--frames=%llu", &UI::frames) == 1 ||
+		    sscanf(this_arg, "--es=%u", &UI::es_interval) == 1 ||
+		    sscanf(this_arg, "--crc=%d", &UI::crc) == 1 ||
+		    sscanf(this_arg, "--sc0=%u", &UI::sc0) == 1 ||
+		    sscanf(this_arg, "--noise=%d", &UI::noise) == 1 ||
+		    sscanf(this_arg, "--fault_id=%u", &UI::fault_id) == 1 ||
+		    sscanf(this_arg, "--fault_seq=%u", &UI::fault_seq) == 1 ||
+		    sscanf(this_arg, "--fault_bs=%u", &UI::fault_bs) == 1 ||
+		    sscanf(this_arg, "--fault_drop=%u", &UI::fault_drop) == 1 ||
+		    sscanf(this_arg, "--seed=%u", &UI::seed) == 1 ||
+		    sscanf(this_arg, "--threads=%d", &UI::threads) == 1){
+			;
+		}else if (sscanf(this_arg, "--outfile=%127s", fname) == 1){
+			UI::fout = fopen(fname, "w");
+			if (!UI::fout){
+				perror(fname);
+				exit(1);
+			}
+		}else if (this_arg[0] == '-'){
+			fprintf(stderr, "ERROR: unknown option \"%s\"\n", this_arg);
+			exit(1);
+		}else if (gen.addSite(this_arg) != 0){
+			fprintf(stderr, "ERROR: failed to create site \"%s\"\n",
+					this_arg);
+			exit(1);
+		}
+	}
+	if (gen.frameWords() == 0){
+		fprintf(stderr, "USAGE: acq_synth [opts] site-def [site-def ...]\n");
+		exit(1);
+	}
+	if (UI::noise < 0 || UI::noise > 24){
+		UI::noise = 24;
+	}
+	if (UI::threads < 1){
+		UI::threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (UI::threads < 1) UI::threads = 1;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	FrameGenerator gen;
+
+	if (getenv("VERBOSE")){
+		verbose = atoi(getenv("VERBOSE"));
+	}
+	acqTraceInit();
+	ui(gen, argc, argv);
+	gen.init();
+	return Synth(gen, UI::threads)(UI::fout);
+}
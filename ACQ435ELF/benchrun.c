@@ -0,0 +1,83 @@
+/* ------------------------------------------------------------------------- */
+/* benchrun.c - run a command, report elapsed time and peak RSS             */
+/* ------------------------------------------------------------------------- */
+/*   Copyright (C) 2014 Peter Milne, D-TACQ Solutions Ltd
+ *                      <Peter dot Milne at D hyphen TACQ dot com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of Version 2 of the GNU General Public License
+    as published by the Free Software Foundation;
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * USAGE: benchrun INFILE OUTFILE cmd [args]
+ * runs cmd with stdin from INFILE, stdout to OUTFILE ("-" : inherit),
+ * stderr discarded, then prints "seconds maxrss_kb exit_status"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+static void redirect(const char* fname, int fd, int flags)
+{
+	int fx;
+
+	if (strcmp(fname, "-") == 0){
+		return;
+	}
+	if ((fx = open(fname, flags, 0644)) < 0){
+		perror(fname);
+		_exit(127);
+	}
+	dup2(fx, fd);
+	close(fx);
+}
+
+int main(int argc, char* argv[])
+{
+	struct timespec t0, t1;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	if (argc < 4){
+		fprintf(stderr, "USAGE: benchrun INFILE OUTFILE cmd [args]\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((pid = fork()) == 0){
+		redirect(argv[1], 0, O_RDONLY);
+		redirect(argv[2], 1, O_WRONLY|O_CREAT|O_TRUNC);
+		redirect("/dev/null", 2, O_WRONLY);
+		execvp(argv[3], argv+3);
+		_exit(127);
+	}
+	if (pid < 0 || wait4(pid, &status, 0, &ru) != pid){
+		perror("benchrun");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("%.6f %ld %d\n",
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9,
+		ru.ru_maxrss,
+		WIFEXITED(status)? WEXITSTATUS(status): 128+WTERMSIG(status));
+	return 0;
+}
@@ -8,32 +8,117 @@
 
 /* extract single channel from data set */
 
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
 
+#include "acq-container.h"
+
 int NCHAN=96;
 int NCOLS=2;		// =2 TWO col data, skip first
+int SHARED_SC=0;	// =1 sc per frame, =2 sc per block of frames
 
-
+unsigned long long FIRST;	// first sample to extract
+unsigned long long COUNT;	// 0: to end of file
 
 int extract_chan1(int chan, FILE* fpin, FILE* fpout, int* buf)
 {
-	while(fread(buf, sizeof(int), NCHAN, fpin) == NCHAN){
+	unsigned long long isam = 0;
+	while((!COUNT || isam++ < COUNT) &&
+			fread(buf, sizeof(int), NCHAN, fpin) == NCHAN){
 		fwrite(&buf[chan-1], sizeof(int), 1, fpout);
 	}
+	return 0;
 }
 int extract_chan2(int chan, FILE* fpin, FILE* fpout, int* buf)
 {
-	while(fread(buf, sizeof(int), NCHAN*NCOLS, fpin) == NCHAN*NCOLS){
+	unsigned long long isam = 0;
+	while((!COUNT || isam++ < COUNT) &&
+			fread(buf, sizeof(int), NCHAN*NCOLS, fpin) == NCHAN*NCOLS){
 		fwrite(&buf[(chan-1)*NCOLS+1], sizeof(int), 1, fpout);
 	}
+	return 0;
+}
+
+/* acq435_tschan --two_column=2 : sc ch1 .. chN */
+int extract_chan_sc(int chan, FILE* fpin, FILE* fpout, int* buf)
+{
+	unsigned long long isam = 0;
+	while((!COUNT || isam++ < COUNT) &&
+			fread(buf, sizeof(int), 1+NCHAN, fpin) == 1+NCHAN){
+		fwrite(&buf[chan], sizeof(int), 1, fpout);
+	}
+	return 0;
+}
+/* acq435_tschan --two_column=3 : sc0 nframes {ch1 .. chN}[nframes] */
+int extract_chan_scblock(int chan, FILE* fpin, FILE* fpout, int* buf)
+{
+	unsigned hdr[2];
+	unsigned long long isam = 0;
+	unsigned long long skip = FIRST;
+
+	while(fread(hdr, sizeof(unsigned), 2, fpin) == 2){
+		unsigned nframes = hdr[1];
+		if (skip >= nframes){
+			skip -= nframes;
+			if (fseeko(fpin, (off_t)nframes*NCHAN*sizeof(int), SEEK_CUR)){
+				return 1;
+			}
+			continue;
+		}
+		for (unsigned ifr = 0; ifr < nframes; ++ifr){
+			if (fread(buf, sizeof(int), NCHAN, fpin) != NCHAN){
+				return 1;
+			}
+			if (skip){
+				--skip;
+			}else if (COUNT && isam++ >= COUNT){
+				return 0;
+			}else{
+				fwrite(&buf[chan-1], sizeof(int), 1, fpout);
+			}
+		}
+	}
+	return 0;
+}
+
+/* container carries NCHAN, NCOLS in the header, and seeks by index */
+int extract_chan_cf(int chan, ACQCF_Reader* cfr, FILE* fpout)
+{
+	const ACQCF_Header* hdr = acqcfHeader(cfr);
+	int* buf = new int[hdr->record_words];
+	int ix;
+	unsigned long long isam = 0;
+	int rc;
+
+	if (chan < 1 || chan > hdr->nchan){
+		fprintf(stderr, "ERROR: chan %d not in 1..%d\n", chan, hdr->nchan);
+		return 1;
+	}
+	switch(hdr->ncols){
+	case ACQCF_TWO_COLUMN:
+		ix = (chan-1)*2+1; break;
+	case ACQCF_SHARED_SC:
+		ix = chan; break;
+	default:
+		ix = chan-1;
+	}
+	if (FIRST && acqcfSeek(cfr, FIRST) != 0){
+		fprintf(stderr, "ERROR: sample %llu not found\n", FIRST);
+		return 1;
+	}
+	while((!COUNT || isam++ < COUNT) &&
+			(rc = acqcfRead(cfr, (unsigned*)buf)) == 1){
+		fwrite(&buf[ix], sizeof(int), 1, fpout);
+	}
+	return rc < 0;
 }
 
 int extract_chan(int chan, char* fromfile, char* tofile)
 {
 	FILE* fpin = fopen(fromfile, "r");
-	assert(chan >= 1 && chan <= NCHAN);
 	if (fpin == 0){
 		perror(fromfile); return 1;
 	}
@@ -41,6 +126,23 @@ int extract_chan(int chan, char* fromfile, char* tofile)
 	if (fpout == 0){
 		perror(tofile); return 1;
 	}
+	ACQCF_Reader* cfr = acqcfOpenReader(fpin);
+	if (cfr){
+		return extract_chan_cf(chan, cfr, fpout);
+	}
+	assert(chan >= 1 && chan <= NCHAN);
+	switch(SHARED_SC){
+	case 1:
+		if (FIRST && fseeko(fpin, FIRST*(1+NCHAN)*sizeof(int), SEEK_SET)){
+			perror(fromfile); return 1;
+		}
+		return extract_chan_sc(chan, fpin, fpout, new int[1+NCHAN]);
+	case 2:
+		return extract_chan_scblock(chan, fpin, fpout, new int[NCHAN]);
+	}
+	if (FIRST && fseeko(fpin, FIRST*NCHAN*NCOLS*sizeof(int), SEEK_SET)){
+		perror(fromfile); return 1;
+	}
 	switch(NCOLS){
 	case 2:
 		return extract_chan2(chan, fpin, fpout, new int[NCHAN*NCOLS]);
@@ -48,6 +150,7 @@ int extract_chan(int chan, char* fromfile, char* tofile)
 		return extract_chan1(chan, fpin, fpout, new int[NCHAN]);
 	default:
 		fprintf(stderr, "case NCOLS=%d NOT SUPPORTED\n", NCOLS);
+		return 1;
 	}
 
 }
@@ -58,10 +161,14 @@ int main(int argc, char* argv[])
 
 	if (getenv("NCHAN")) NCHAN = atoi(getenv("NCHAN"));
 	if (getenv("NCOLS")) NCOLS = atoi(getenv("NCOLS"));
-	if (argc == 4){
+	if (getenv("SHARED_SC")) SHARED_SC = atoi(getenv("SHARED_SC"));
+	if (argc >= 4 && argc <= 6){
+		if (argc > 4) FIRST = strtoull(argv[4], 0, 0);
+		if (argc > 5) COUNT = strtoull(argv[5], 0, 0);
 		return extract_chan(atoi(argv[1]), argv[2], argv[3]);
 	}else{
-		fprintf(stderr, "USAGE: extract_chan CH from-file to-file\n");
+		fprintf(stderr, "USAGE: extract_chan CH from-file to-file "
+				"[first-sample [nsamples]]\n");
 		return 1;
 	}
 }
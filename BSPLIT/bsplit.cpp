@@ -37,6 +37,8 @@
 #include <vector>
 #include <time.h>
 
+#include "acq-container.h"
+
 #define USE_STDIN	"-"
 
 using namespace std;
@@ -81,6 +83,7 @@ class BSplitterImpl : public BSplitter {
 	vector<FILE*> fp_out;
 	bool using_stdin;
 	T* buf;
+	ACQCF_Reader* cfr;
 
 	void onSplit01(const char* fn){
 		using_stdin = strcmp(fn, USE_STDIN) == 0;
@@ -89,6 +92,15 @@ class BSplitterImpl : public BSplitter {
 			perror(fn);
 			exit(1);
 		}
+		if (!using_stdin && (cfr = acqcfOpenReader(fp_in)) != 0){
+			if (sizeof(T) != sizeof(unsigned) ||
+			    acqcfHeader(cfr)->record_words != record_len){
+				fprintf(stderr, "ERROR: %s container record %d LW, "
+					"want --nfields=%d --wordsize=4\n", fn,
+					acqcfHeader(cfr)->record_words, record_len);
+				exit(1);
+			}
+		}
 		const char* of_root = using_stdin? "bsplit": fn;
 
 		for (int ii = 0; ii < fields.size(); ++ii){
@@ -106,12 +118,24 @@ class BSplitterImpl : public BSplitter {
 		for (int ii = 0; ii < fields.size(); ++ii){
 			fclose(fp_out[ii]);
 		}
+		if (cfr){
+			acqcfCloseReader(cfr);
+			cfr = 0;
+		}
+		fp_out.clear();
 		if (!using_stdin){
 			fclose(fp_in);
 		}
 	}
+	bool readRecord() {
+		if (cfr){
+			return acqcfRead(cfr, (unsigned*)buf) == 1;
+		}else{
+			return fread(buf, sizeof(T), record_len, fp_in) == record_len;
+		}
+	}
 	void onSplitMain() {
-		while(fread(buf, sizeof(T), record_len, fp_in) == record_len){
+		while(readRecord()){
 			for (int ii = 0; ii < fields.size(); ++ii){
 				fwrite(&buf[offset(ii)], sizeof(T), 1, fp_out[ii]);
 			}
@@ -120,7 +144,8 @@ class BSplitterImpl : public BSplitter {
 public:
 	BSplitterImpl(int _record_len) : BSplitter(_record_len),
 		using_stdin(false),
-		buf(new T[_record_len])
+		buf(new T[_record_len]),
+		cfr(0)
 	{}
 	virtual ~BSplitterImpl() {
 		delete [] buf;
@@ -130,6 +155,7 @@ public:
 		onSplit01(fn);
 		onSplitMain();
 		onSplit99();
+		return 0;
 	}
 };
 
@@ -172,9 +198,32 @@ void ui(int argc, const char* argv[])
 }
 
 
+/* a container says how long its records are */
+void nfieldsFromContainer(const char* fn)
+{
+	FILE* fp = fopen(fn, "r");
+	if (fp){
+		ACQCF_Reader* cfr = acqcfOpenReader(fp);
+		if (cfr){
+			UI::nfields = acqcfHeader(cfr)->record_words;
+			UI::wordsize = sizeof(unsigned);
+			if (UI::verbose){
+				fprintf(stderr, "%s: container sites \"%s\" "
+					"nfields %d\n", fn,
+					acqcfHeader(cfr)->sites, UI::nfields);
+			}
+			acqcfCloseReader(cfr);
+		}
+		fclose(fp);
+	}
+}
+
 int main(int argc, const char* argv[])
 {
 	ui(argc, argv);
+	if (UI::fnames != NULL && UI::fnames[0] != NULL){
+		nfieldsFromContainer(UI::fnames[0]);
+	}
 	BSplitter* sp = BSplitter::create(UI::wordsize, UI::nfields);
 
 	int fnum;